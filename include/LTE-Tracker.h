@@ -1,6 +1,9 @@
 #ifndef HAVE_LTE_TRACKER_H
 #define HAVE_LTE_TRACKER_H
 
+#include <string.h>
+#include <atomic>
+
 //
 // Data structures used to communicate between threads.
 //
@@ -15,6 +18,40 @@ typedef struct {
   double frame_timing;
 } td_fifo_pdu_t;
 
+// Per-cell processing state owned by the tracker worker pool. Defined in
+// tracker_thread.cpp; opaque everywhere else.
+struct tracker_cell_state_t;
+void tracker_state_free(tracker_cell_state_t * state);
+
+// All of the measurements produced while tracking one cell. The worker
+// servicing the cell maintains a working copy and periodically publishes
+// it for the display thread; see tracked_cell_t below. Plain data with no
+// locks of its own. All vector/matrix members keep a fixed size after
+// construction so that copying never reallocates the source.
+typedef struct {
+  double mib_decode_failures;
+  itpp::vec crs_tp;
+  itpp::vec crs_sp_raw;
+  itpp::vec crs_np;
+  itpp::vec crs_tp_av;
+  itpp::vec crs_sp_raw_av;
+  itpp::vec crs_np_av;
+  itpp::cmat ce;
+  double sync_tp;
+  double sync_sp;
+  double sync_np;
+  double sync_np_blank;
+  itpp::cvec sync_ce;
+  double sync_tp_av;
+  double sync_sp_av;
+  double sync_np_av;
+  double sync_np_blank_av;
+  // Frequency domain channel autocorrelation.
+  itpp::cvec ac_fd;
+  // Time domain channel autocorrelation.
+  itpp::cvec ac_td;
+} cell_meas_t;
+
 // Structure to describe a cell which is currently being tracked.
 class tracked_cell_t {
   public:
@@ -42,31 +79,42 @@ class tracked_cell_t {
       frame_timing_private=ft;
       fifo_peak_size=0;
       kill_me=false;
-      ac_fd.set_size(12);
-      ac_fd=std::complex <double> (0,0);
-      ac_td.set_size(72);
-      ac_td=std::complex <double> (0,0);
       tracker_thread_ready=false;
-      mib_decode_failures=0;
-      crs_tp=itpp::vec(4);
-      crs_sp_raw=itpp::vec(4);
-      crs_sp_raw=NAN;
-      crs_np=itpp::vec(4);
-      crs_np=NAN;
-      crs_tp_av=itpp::vec(4);
-      crs_sp_raw_av=itpp::vec(4);
-      crs_sp_raw_av=NAN;
-      crs_np_av=itpp::vec(4);
-      crs_np_av=NAN;
-      sync_tp=NAN;
-      sync_sp=NAN;
-      sync_np=NAN;
-      sync_np_blank=NAN;
-      sync_tp_av=NAN;
-      sync_sp_av=NAN;
-      sync_np_av=NAN;
-      sync_np_blank_av=NAN;
+      meas.mib_decode_failures=0;
+      // Sized to n_ports, matching the vectors the worker assigns in;
+      // a size change here would reallocate under a concurrent
+      // read_meas().
+      meas.crs_tp=itpp::vec(n_ports);
+      meas.crs_sp_raw=itpp::vec(n_ports);
+      meas.crs_sp_raw=NAN;
+      meas.crs_np=itpp::vec(n_ports);
+      meas.crs_np=NAN;
+      meas.crs_tp_av=itpp::vec(n_ports);
+      meas.crs_sp_raw_av=itpp::vec(n_ports);
+      meas.crs_sp_raw_av=NAN;
+      meas.crs_np_av=itpp::vec(n_ports);
+      meas.crs_np_av=NAN;
+      meas.ce.set_size(n_ports,72);
+      meas.ce=std::complex <double> (0,0);
+      meas.sync_tp=NAN;
+      meas.sync_sp=NAN;
+      meas.sync_np=NAN;
+      meas.sync_np_blank=NAN;
+      meas.sync_ce.set_size(72);
+      meas.sync_ce=std::complex <double> (0,0);
+      meas.sync_tp_av=NAN;
+      meas.sync_sp_av=NAN;
+      meas.sync_np_av=NAN;
+      meas.sync_np_blank_av=NAN;
+      meas.ac_fd.set_size(12);
+      meas.ac_fd=std::complex <double> (0,0);
+      meas.ac_td.set_size(72);
+      meas.ac_td=std::complex <double> (0,0);
+      meas_snapshot=meas;
+      meas_seq.store(0,std::memory_order_relaxed);
       launched=false;
+      scheduled=false;
+      tracker_state=NULL;
     }
     inline uint8 const n_symb_dl() const {
       return (cp_type==cp_type_t::NORMAL)?7:((cp_type==cp_type_t::EXTENDED)?6:-1);
@@ -82,58 +130,93 @@ class tracked_cell_t {
     const phich_resource_t::phich_resource_t phich_resource;
     const uint32 serial_num;
 
-    // Do we need this?
-    boost::thread thread;
+    // Free all PDUs still sitting in the fifo or in the recycling pool,
+    // along with the worker pool's processing state for this cell.
+    ~tracked_cell_t(void) {
+      while (!fifo.empty()) {
+        delete fifo.front();
+        fifo.pop();
+      }
+      for (uint32 t=0;t<pdu_pool.size();t++) {
+        delete pdu_pool[t];
+      }
+      if (tracker_state!=NULL) {
+        tracker_state_free(tracker_state);
+      }
+    }
 
     // Mutex and data structures for the flow of information from the
-    // producer thread to the tracker thread.
+    // producer thread to the tracker worker pool. PDUs are passed by pointer
+    // and delivered in subframe sized batches; consumed PDUs go back to
+    // pdu_pool so that their cvec storage is recycled instead of being
+    // reallocated for every OFDM symbol.
     boost::mutex fifo_mutex;
-    boost::condition fifo_condition;
-    std::queue <td_fifo_pdu_t> fifo;
+    std::queue <td_fifo_pdu_t *> fifo;
+    std::vector <td_fifo_pdu_t *> pdu_pool;
     uint32 fifo_peak_size;
 
-    // Indicates that the tracker process is ready to receive data.
+    // Return a consumed PDU (and its storage) to the pool.
+    inline void pdu_release(td_fifo_pdu_t * pdu) {
+      boost::mutex::scoped_lock lock(fifo_mutex);
+      pdu_pool.push_back(pdu);
+    }
+
+    // Indicates that the tracker state has been initialized and the cell
+    // is ready to receive data.
     bool tracker_thread_ready;
-    // Indicates that the thread has been launched
+    // Indicates that the cell has been handed to the worker pool.
     bool launched;
+    // True while a service job for this cell is pending in the worker
+    // pool or being executed by a worker. Guarded by the pool's mutex.
+    // The producer thread may only delete a killed cell once this is
+    // false.
+    bool scheduled;
+    // Per-cell processing state, created by the worker pool on the
+    // cell's first service and freed by the destructor above.
+    tracker_cell_state_t * tracker_state;
 
-    // Mutex and measurement data produced by the tracker thread and read by
-    // the display thread.
-    boost::mutex meas_mutex;
-    double mib_decode_failures;
-    itpp::vec crs_tp;
-    itpp::vec crs_sp_raw;
-    itpp::vec crs_np;
-    itpp::vec crs_tp_av;
-    itpp::vec crs_sp_raw_av;
-    itpp::vec crs_np_av;
-    itpp::cmat ce;
-    double sync_tp;
-    double sync_sp;
-    double sync_np;
-    double sync_np_blank;
-    itpp::cvec sync_ce;
-    double sync_tp_av;
-    double sync_sp_av;
-    double sync_np_av;
-    double sync_np_blank_av;
-    // Frequency domain channel autocorrelation.
-    itpp::cvec ac_fd;
-    // Time domain channel autocorrelation.
-    itpp::cvec ac_td;
+    // Working copy of the measurement data. Owned exclusively by the
+    // worker currently servicing this cell; no lock is needed because a
+    // cell is never serviced by two workers at once.
+    cell_meas_t meas;
 
-    // Read/write frame_timing (via mutex).
-    // Only one thread (tracker_thread) can update frame_timing. We
-    // only need to ensure that no thread reads a partial value before
-    // the new value is completely written.
+    // Publish the working measurements for the display thread. Called by
+    // the servicing worker; a seqlock (rather than a mutex) is used so
+    // that the display thread can never block the real-time path, no
+    // matter how long it spends rendering. Since all vector members have
+    // fixed sizes, the copy below overwrites elements in place and never
+    // reallocates storage that a concurrent reader might be copying from.
+    inline void publish_meas(void) {
+      // An odd sequence number marks a write in progress.
+      meas_seq.fetch_add(1,std::memory_order_acq_rel);
+      meas_snapshot=meas;
+      meas_seq.fetch_add(1,std::memory_order_acq_rel);
+    }
+    // Copy out a consistent snapshot of the measurements. Retries if a
+    // publish happens mid-copy; publishes are rare (once per service
+    // job) so the retry loop terminates quickly.
+    void read_meas(cell_meas_t & out) const {
+      while (true) {
+        const uint32 seq_pre=meas_seq.load(std::memory_order_acquire);
+        if (seq_pre&1)
+          continue;
+        out=meas_snapshot;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (meas_seq.load(std::memory_order_relaxed)==seq_pre)
+          break;
+      }
+    }
+
+    // Read/write frame_timing.
+    // Only the worker currently servicing this cell updates frame_timing.
+    // We only need to ensure that no thread reads a partial value before
+    // the new value is completely written, which a single atomic word
+    // provides without any locking.
     inline double frame_timing() {
-      boost::mutex::scoped_lock lock(frame_timing_mutex);
-      double r=frame_timing_private;
-      return r;
+      return frame_timing_private.load(std::memory_order_relaxed);
     }
     inline void frame_timing(const double & ft) {
-      boost::mutex::scoped_lock lock(frame_timing_mutex);
-      frame_timing_private=ft;
+      frame_timing_private.store(ft,std::memory_order_relaxed);
     }
 
     bool kill_me;
@@ -141,8 +224,12 @@ class tracked_cell_t {
   private:
     // Frame timing info is needed by producer, tracker, and display
     // threads.
-    boost::mutex frame_timing_mutex;
-    double frame_timing_private;
+    std::atomic <double> frame_timing_private;
+
+    // Seqlock protected snapshot of the measurements. Written only by
+    // publish_meas() and read only by read_meas().
+    cell_meas_t meas_snapshot;
+    std::atomic <uint32> meas_seq;
 };
 
 // Structure that stores the list of all the tracked cells.
@@ -154,6 +241,94 @@ typedef struct {
   std::list <tracked_cell_t *> tracked_cells;
 } tracked_cell_list_t;
 
+// Work queue feeding the fixed-size tracker worker pool.
+//
+// Cells used to each own a dedicated thread; on a 4 core box tracking 8
+// cells that meant 8 bursty threads competing with the producer, searcher,
+// and display threads. Instead, a handful of interchangeable workers
+// service whichever cells have data queued: the producer schedules a cell
+// after delivering a subframe batch and any idle worker picks it up.
+// A cell is never serviced by two workers at once (symbol order within a
+// cell matters), which the 'scheduled' flag guarantees.
+class tracker_pool_t {
+  public:
+    // Mark the cell as needing service and wake one worker, unless a job
+    // for this cell is already pending or in progress (in which case
+    // that job will consume the new data).
+    inline void schedule(tracked_cell_t & cell) {
+      boost::mutex::scoped_lock lock(mutex);
+      if (!cell.scheduled) {
+        cell.scheduled=true;
+        pending.push(&cell);
+        condition.notify_one();
+      }
+    }
+    // Is a job for this cell pending or in progress?
+    inline bool in_service(tracked_cell_t & cell) {
+      boost::mutex::scoped_lock lock(mutex);
+      return cell.scheduled;
+    }
+    boost::mutex mutex;
+    boost::condition condition;
+    std::queue <tracked_cell_t *> pending;
+};
+
+// Lock-free latency histogram. record() may be called from the thread
+// being measured without ever blocking it; the display and export code
+// read the counters with relaxed ordering and may see values that are
+// a few updates stale, which is harmless for monitoring purposes.
+//
+// Bin n counts latencies in the range [2^n,2^(n+1)) microseconds, with
+// the final bin absorbing everything larger. 24 bins cover 1us up to
+// about 8 seconds.
+class lat_hist_t {
+  public:
+    static const uint8 n_bins=24;
+    lat_hist_t(void) {
+      for (uint8 t=0;t<n_bins;t++)
+        bins[t].store(0,std::memory_order_relaxed);
+      n_total.store(0,std::memory_order_relaxed);
+      sum_us.store(0,std::memory_order_relaxed);
+    }
+    inline void record(const double & seconds) {
+      const uint64 us=(uint64)(seconds*1e6);
+      uint8 bin=0;
+      while ((us>>(bin+1))&&(bin<n_bins-1))
+        bin++;
+      bins[bin].fetch_add(1,std::memory_order_relaxed);
+      sum_us.fetch_add(us,std::memory_order_relaxed);
+      n_total.fetch_add(1,std::memory_order_relaxed);
+    }
+    inline uint64 count(void) const {
+      return n_total.load(std::memory_order_relaxed);
+    }
+    inline double mean_us(void) const {
+      const uint64 n=n_total.load(std::memory_order_relaxed);
+      return (n==0)?0:((double)sum_us.load(std::memory_order_relaxed)/n);
+    }
+    // Upper edge (in us) of the bin containing the requested quantile.
+    double quantile_us(const double & frac) const {
+      const uint64 n=n_total.load(std::memory_order_relaxed);
+      if (n==0)
+        return 0;
+      const uint64 target=(uint64)(frac*n);
+      uint64 cum=0;
+      for (uint8 t=0;t<n_bins;t++) {
+        cum+=bins[t].load(std::memory_order_relaxed);
+        if (cum>=target)
+          return (double)(((uint64)2)<<t);
+      }
+      return (double)(((uint64)2)<<(n_bins-1));
+    }
+    inline uint64 bin_count(const uint8 & bin) const {
+      return bins[bin].load(std::memory_order_relaxed);
+    }
+  private:
+    std::atomic <uint64> bins[n_bins];
+    std::atomic <uint64> n_total;
+    std::atomic <uint64> sum_us;
+};
+
 // Global data shared by all threads
 class global_thread_data_t {
   public:
@@ -167,55 +342,66 @@ class global_thread_data_t {
       fc_programmed(fc_programmed),
       fs_programmed(fs_programmed)
     {
-      searcher_cycle_time_private=0;
-      cell_seconds_dropped_private=0;
-      raw_seconds_dropped_private=0;
+      frequency_offset_private.store(0,std::memory_order_relaxed);
+      searcher_cycle_time_private.store(0,std::memory_order_relaxed);
+      cell_seconds_dropped_private.store(0,std::memory_order_relaxed);
+      raw_seconds_dropped_private.store(0,std::memory_order_relaxed);
+      tracker_symbols_processed.store(0,std::memory_order_relaxed);
+      searcher_duty_cycle_private.store(0.25,std::memory_order_relaxed);
     }
+    // Instrumentation. These are lock-free so the measured threads are
+    // never blocked by a reader; see lat_hist_t. The raw sample fifo
+    // depth and high water mark are available (also lock-free) from
+    // sampbuf_ring_t.
+    //
+    // Full searcher cycles (one 80ms capture through MIB decode).
+    lat_hist_t searcher_cycle_hist;
+    // Per OFDM symbol processing time, all tracker threads combined.
+    // Time spent waiting for data is not included.
+    lat_hist_t tracker_symbol_hist;
+    std::atomic <uint64> tracker_symbols_processed;
     // These values will never change.
     const double fc_requested;
     const double fc_programmed;
     const double fs_programmed;
-    // Read/write frequency offset (via mutex).
-    // Mutex makes sure that no read or write is interrupted when
-    // only part of the data has been read.
+    // Read/write frequency offset.
+    // A single atomic word makes sure that no thread reads a partial
+    // value, without the lock/unlock churn that the old per-field mutex
+    // caused on the producer thread's hot path. No other data is
+    // published through these values, so relaxed ordering suffices.
     inline double frequency_offset() {
-      boost::mutex::scoped_lock lock(frequency_offset_mutex);
-      double r=frequency_offset_private;
-      return r;
+      return frequency_offset_private.load(std::memory_order_relaxed);
     }
     inline void frequency_offset(const double & f) {
-      boost::mutex::scoped_lock lock(frequency_offset_mutex);
-      frequency_offset_private=f;
+      frequency_offset_private.store(f,std::memory_order_relaxed);
     }
-    // Read/write searcher cycle time (via mutex).
-    // Mutex makes sure that no read or write is interrupted when
-    // only part of the data has been read.
+    // Read/write searcher cycle time.
     inline double searcher_cycle_time() {
-      boost::mutex::scoped_lock lock(searcher_cycle_time_mutex);
-      double r=searcher_cycle_time_private;
-      return r;
+      return searcher_cycle_time_private.load(std::memory_order_relaxed);
     }
     inline void searcher_cycle_time(const double & t) {
-      boost::mutex::scoped_lock lock(searcher_cycle_time_mutex);
-      searcher_cycle_time_private=t;
+      searcher_cycle_time_private.store(t,std::memory_order_relaxed);
     }
     inline uint32 cell_seconds_dropped() {
-      boost::mutex::scoped_lock lock(cell_seconds_dropped_mutex);
-      double r=cell_seconds_dropped_private;
-      return r;
+      return cell_seconds_dropped_private.load(std::memory_order_relaxed);
     }
     inline void cell_seconds_dropped_inc() {
-      boost::mutex::scoped_lock lock(cell_seconds_dropped_mutex);
-      cell_seconds_dropped_private+=1;
+      cell_seconds_dropped_private.fetch_add(1,std::memory_order_relaxed);
     }
     inline uint32 raw_seconds_dropped() {
-      boost::mutex::scoped_lock lock(raw_seconds_dropped_mutex);
-      double r=raw_seconds_dropped_private;
-      return r;
+      return raw_seconds_dropped_private.load(std::memory_order_relaxed);
     }
     inline void raw_seconds_dropped_inc() {
-      boost::mutex::scoped_lock lock(raw_seconds_dropped_mutex);
-      raw_seconds_dropped_private+=1;
+      raw_seconds_dropped_private.fetch_add(1,std::memory_order_relaxed);
+    }
+    // Read/write the searcher duty cycle. The searcher sleeps between
+    // work quanta so that, while cells are being tracked, its CPU usage
+    // stays at or below this fraction. 1.0 disables the pacing.
+    inline double searcher_duty_cycle() {
+      return searcher_duty_cycle_private.load(std::memory_order_relaxed);
+    }
+    inline void searcher_duty_cycle(const double & d) {
+      searcher_duty_cycle_private.store(d,std::memory_order_relaxed);
     }
     uint32 searcher_thread_id;
     uint32 producer_thread_id;
@@ -224,14 +410,11 @@ class global_thread_data_t {
   private:
     // The frequency offset of the dongle. This value will be updated
     // continuously.
-    boost::mutex frequency_offset_mutex;
-    double frequency_offset_private;
-    boost::mutex searcher_cycle_time_mutex;
-    double searcher_cycle_time_private;
-    boost::mutex cell_seconds_dropped_mutex;
-    uint32 cell_seconds_dropped_private;
-    boost::mutex raw_seconds_dropped_mutex;
-    uint32 raw_seconds_dropped_private;
+    std::atomic <double> frequency_offset_private;
+    std::atomic <double> searcher_cycle_time_private;
+    std::atomic <uint32> cell_seconds_dropped_private;
+    std::atomic <uint32> raw_seconds_dropped_private;
+    std::atomic <double> searcher_duty_cycle_private;
 };
 
 // IPC between main thread and searcher thread covering data capture issues.
@@ -243,12 +426,76 @@ typedef struct {
   double late;
 } capbuf_sync_t;
 
+// Lock-free single-producer/single-consumer ring buffer carrying the
+// raw IQ bytes from the USB callback (or the file replay loop) to the
+// producer thread.
+//
+// The previous deque based fifo performed two pop_front() calls per
+// complex sample under a mutex (roughly 4M deque operations per second
+// at 1.92Msps) and the USB callback had to take the same mutex for
+// every transfer. Here each side owns one monotonically increasing
+// position counter and whole transfer blocks are moved with at most
+// two memcpy's, so neither side can ever block the other.
+class sampbuf_ring_t {
+  public:
+    sampbuf_ring_t(void) : buf(ring_size),head(0),tail(0),peak_size_private(0) { }
+    // Number of bytes currently waiting in the ring.
+    inline uint32 size(void) const {
+      return head.load(std::memory_order_acquire)-tail.load(std::memory_order_acquire);
+    }
+    // Append up to len bytes. Bytes that do not fit are discarded (the
+    // consumer's backlog dropping starts long before the ring can fill
+    // up). May only be called from the single producing thread.
+    // Returns the number of bytes accepted.
+    uint32 write(const uint8 * data,const uint32 len) {
+      const uint64 w=head.load(std::memory_order_relaxed);
+      const uint64 r=tail.load(std::memory_order_acquire);
+      const uint32 used=w-r;
+      const uint32 n=MIN(len,ring_size-used);
+      const uint32 idx=(uint32)(w&(ring_size-1));
+      const uint32 first=MIN(n,ring_size-idx);
+      memcpy(&buf[idx],data,first);
+      memcpy(&buf[0],data+first,n-first);
+      head.store(w+n,std::memory_order_release);
+      if (used+n>peak_size_private)
+        peak_size_private=used+n;
+      return n;
+    }
+    // Copy out and consume exactly len bytes. len must not exceed
+    // size(). May only be called from the single consuming thread.
+    void read(uint8 * data,const uint32 len) {
+      const uint64 r=tail.load(std::memory_order_relaxed);
+      const uint32 idx=(uint32)(r&(ring_size-1));
+      const uint32 first=MIN(len,ring_size-idx);
+      memcpy(data,&buf[idx],first);
+      memcpy(data+first,&buf[0],len-first);
+      tail.store(r+len,std::memory_order_release);
+    }
+    // Consume len bytes without copying them out. len must not exceed
+    // size(). May only be called from the single consuming thread.
+    inline void discard(const uint32 len) {
+      tail.store(tail.load(std::memory_order_relaxed)+len,std::memory_order_release);
+    }
+    // Largest number of bytes that has ever been in the ring. Only
+    // updated by the producing thread; reads from other threads may
+    // lag slightly.
+    inline uint32 peak_size(void) const {
+      return peak_size_private;
+    }
+  private:
+    // Must be a power of two and large enough that the producer
+    // thread's backlog dropping (which starts at 1.5s of data) always
+    // kicks in before the ring fills.
+    static const uint32 ring_size=1<<24;
+    std::vector <uint8> buf;
+    std::atomic <uint64> head;
+    std::atomic <uint64> tail;
+    uint32 peak_size_private;
+};
+
 // IPC between main thread and producer thread.
 typedef struct {
-  boost::mutex mutex;
-  boost::condition condition;
-  std::deque <uint8> fifo;
-  uint32 fifo_peak_size;
+  sampbuf_ring_t fifo;
 } sampbuf_sync_t;
 
 // Small helper function to increment the slot number and the symbol number.
@@ -268,10 +515,11 @@ void producer_thread(
   capbuf_sync_t & capbuf_sync,
   global_thread_data_t & global_thread_data,
   tracked_cell_list_t & tracked_cell_list,
+  tracker_pool_t & tracker_pool,
   double & fc
 );
-void tracker_thread(
-  tracked_cell_t & tracked_cell,
+void tracker_worker_thread(
+  tracker_pool_t & tracker_pool,
   global_thread_data_t & global_thread_data
 );
 void searcher_thread(
@@ -283,7 +531,8 @@ void display_thread(
   sampbuf_sync_t & sampbuf_sync,
   global_thread_data_t & global_thread_data,
   tracked_cell_list_t & tracked_cell_list,
-  bool & expert_mode
+  bool & expert_mode,
+  std::string & stats_filename
 );
 
 #endif
@@ -18,6 +18,46 @@
 #ifndef HAVE_CAPBUF_H
 #define HAVE_CAPBUF_H
 
+// Rolling ring of raw IQ bytes fed by a background reader thread that
+// streams the dongle continuously. Once started, the stream keeps
+// running across retunes; capture windows are served straight out of
+// the ring so that a second window at the same center frequency costs
+// no USB round trip or settling delay.
+typedef struct capture_ring_t {
+  capture_ring_t(void) : dev(NULL),fc_requested(-1),fc_programmed(-1),n_written(0),n_consumed(0),stop(false),running(false),reader(NULL) {}
+  rtlsdr_dev_t * dev;
+  // Center frequency the ring contents were captured at.
+  double fc_requested;
+  double fc_programmed;
+  boost::mutex mutex;
+  boost::condition condition;
+  // Raw interleaved offset-binary IQ bytes.
+  std::vector <unsigned char> buf;
+  // Total number of bytes ever written into the ring.
+  uint64 n_written;
+  // Stream position where the next window handed out will begin.
+  uint64 n_consumed;
+  bool stop;
+  bool running;
+  boost::thread * reader;
+} capture_ring_t;
+
+// Serves one capture window out of the continuous stream, starting the
+// background reader and (re)tuning the dongle as necessary.
+void capture_data_continuous(
+  // Inputs
+  const double & fc_requested,
+  const double & correction,
+  rtlsdr_dev_t * & dev,
+  capture_ring_t & ring,
+  // Output
+  itpp::cvec & capbuf,
+  double & fc_programmed
+);
+
+// Stops the background reader, if it is running.
+void capture_ring_stop(capture_ring_t & ring);
+
 // Returns a capture buffer either from a file or from live data read
 // from the dongle.
 void capture_data(
@@ -26,6 +66,7 @@ void capture_data(
   const double & correction,
   const bool & save_cap,
   const bool & use_recorded_data,
+  const bool & use_raw_format,
   const std::string & str,
   rtlsdr_dev_t * & dev,
   // Output
@@ -33,6 +33,19 @@ double sigpower(const myType v) {
 #define idft(A) (ifft(A)*sqrt(length(A)))
 #define dft(A) (fft(A)/sqrt(length(A)))
 
+// Replacements for IT++'s fft()/ifft() that reuse cached FFTW plans instead
+// of replanning whenever the transform length changes. See dsp.cpp.
+itpp::cvec fft_cached(const itpp::cvec & x);
+itpp::cvec ifft_cached(const itpp::cvec & x);
+
+// Scaled like idft/dft above, but through the plan cache.
+#define idft_cached(A) (ifft_cached(A)*sqrt(length(A)))
+#define dft_cached(A) (fft_cached(A)/sqrt(length(A)))
+
+// Load/extend/save FFTW wisdom stored under data_dir and warm the calling
+// thread's plan cache. Call once at startup.
+void fft_wisdom_init(const std::string & data_dir);
+
 // Shift a vector in frequency
 //itpp::cvec fshift(const itpp::cvec & v,const double f,const double fs);
 //itpp::cvec fshift(const itpp::cvec & v,const double f);
@@ -71,27 +84,60 @@ inline void fshift_inplace(itpp::cvec &seq,const double f) {
   fshift_inplace(seq,f,2);
 }
 
+// Number of branches in the fractional delay coefficient bank used by
+// tshift() and the number of taps per branch.
+#define TSHIFT_N_PHASES 64
+#define TSHIFT_N_TAPS 8
+
+// Returns the (lazily constructed) polyphase fractional delay coefficient
+// bank. Branch p delays its input by p/TSHIFT_N_PHASES of a sample.
+const double * tshift_filter_bank(void);
+
 // Shift a vector in time
 template <class vectype>
-// Cyclically shift vector to the right by n samples.
+// Cyclically shift vector to the right by n samples. The shift is quantized
+// to 1/TSHIFT_N_PHASES of a sample and any fractional part is applied with
+// a polyphase fractional delay filter, costing TSHIFT_N_TAPS multiplies per
+// output sample.
 void tshift(vectype &v,const double n) {
-  // Currently, only support integer values of n.
-  ASSERT(n==itpp::floor_i(n));
-  if (n>=0) {
-    vectype v_save=v.right(n);
-    for (uint32 t=v.length()-1;t>=n;t--) {
-      v[t]=v[t-n];
+  const int32 len=v.length();
+  const int32 n_q=itpp::round_i(n*TSHIFT_N_PHASES);
+  int32 n_int=itpp::floor_i(n_q/((double)TSHIFT_N_PHASES));
+  const uint32 phase=n_q-n_int*TSHIFT_N_PHASES;
+
+  // The integer part of the shift is a pure rotation.
+  n_int=n_int%len;
+  if (n_int<0)
+    n_int+=len;
+  if (n_int!=0) {
+    vectype v_save=v.right(n_int);
+    for (int32 t=len-1;t>=n_int;t--) {
+      v[t]=v[t-n_int];
     }
-    for (uint32 t=0;t<n;t++) {
+    for (int32 t=0;t<n_int;t++) {
       v[t]=v_save[t];
     }
-  } else {
-    vectype v_save=v.left(n);
-    for (uint32 t=0;t<v.length()-n;t++) {
-      v[t]=v[t+n];
-    }
-    for (uint32 t=0;t<n;t++) {
-      v[t+v.length()-n]=v_save[t];
+  }
+  if (phase==0)
+    return;
+
+  // Apply the fractional part of the shift. Output sample t is formed from
+  // input samples t+(TSHIFT_N_TAPS/2-1) down to t-TSHIFT_N_TAPS/2, wrapped
+  // cyclically.
+  const double * h=tshift_filter_bank()+phase*TSHIFT_N_TAPS;
+  const vectype v_orig(v);
+  for (int32 t=0;t<len;t++) {
+    for (uint32 k=0;k<TSHIFT_N_TAPS;k++) {
+      int32 idx=t+(TSHIFT_N_TAPS/2-1)-(int32)k;
+      if (idx<0)
+        idx+=len;
+      else if (idx>=len)
+        idx-=len;
+      if (k==0) {
+        v[t]=v_orig[idx]*h[k];
+      } else {
+        v[t]+=v_orig[idx]*h[k];
+      }
     }
   }
 }
@@ -0,0 +1,128 @@
+// Copyright 2012 Evrytania LLC (http://www.evrytania.com)
+//
+// Written by James Peroulas <james@evrytania.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HAVE_TENSOR3D_H
+#define HAVE_TENSOR3D_H
+
+#include <vector>
+#include <algorithm>
+
+// Contiguous storage for the large 3D correlation arrays used by the
+// searcher.
+//
+// These arrays used to be stored as vector<vector<vector<T>>>, which
+// performs one heap allocation per innermost row and scatters the rows
+// all over the heap. For an 80ms capture with a large frequency search
+// set this is millions of small allocations and a cache miss on nearly
+// every row change. This class keeps all elements in one allocation
+// with explicit strides.
+//
+// Element (i,j,k) is stored at offset i*d2*d3+k*d2+j, i.e. the middle
+// (time offset) dimension has unit stride. Every hot loop in the
+// searcher streams along the time dimension for a fixed PSS index and
+// frequency hypothesis, so this order turns those loops into linear
+// scans of memory.
+//
+// The nested x[i][j][k] syntax of the old typedefs is preserved through
+// lightweight proxy objects so that existing code does not need to
+// change.
+//
+// This header must be included after the intXX/uintXX typedefs in
+// common.h (common.h includes it in the right place).
+
+// Proxy for x[i][j]; operator[] applies the third index.
+template <class T>
+class tensor3d_row_t {
+  public:
+    tensor3d_row_t(T * base,const uint32 stride,const uint32 len) :
+      m_base(base),m_stride(stride),m_len(len) {}
+    inline T & operator[](const uint32 k) const {
+      return m_base[k*m_stride];
+    }
+    inline uint32 size(void) const {
+      return m_len;
+    }
+  private:
+    T * m_base;
+    uint32 m_stride;
+    uint32 m_len;
+};
+
+// Proxy for x[i]; operator[] applies the second index.
+template <class T>
+class tensor3d_slice_t {
+  public:
+    tensor3d_slice_t(T * base,const uint32 d2,const uint32 d3) :
+      m_base(base),m_d2(d2),m_d3(d3) {}
+    inline tensor3d_row_t <T> operator[](const uint32 j) const {
+      return tensor3d_row_t <T> (m_base+j,m_d2,m_d3);
+    }
+    inline uint32 size(void) const {
+      return m_d2;
+    }
+  private:
+    T * m_base;
+    uint32 m_d2;
+    uint32 m_d3;
+};
+
+template <class T>
+class tensor3d_t {
+  public:
+    tensor3d_t(void) : m_d1(0),m_d2(0),m_d3(0) {}
+    tensor3d_t(const uint32 d1,const uint32 d2,const uint32 d3) {
+      set_size(d1,d2,d3);
+    }
+    tensor3d_t(const uint32 d1,const uint32 d2,const uint32 d3,const T & init) {
+      set_size(d1,d2,d3);
+      std::fill(m_data.begin(),m_data.end(),init);
+    }
+    // Allocate storage. Elements are value initialized (zero for the
+    // numeric types stored here), matching the behavior of the nested
+    // vector typedefs this class replaces.
+    void set_size(const uint32 d1,const uint32 d2,const uint32 d3) {
+      m_d1=d1;
+      m_d2=d2;
+      m_d3=d3;
+      m_data.assign((size_t)d1*d2*d3,T());
+    }
+    inline tensor3d_slice_t <T> operator[](const uint32 i) {
+      return tensor3d_slice_t <T> (&m_data[i*m_d2*m_d3],m_d2,m_d3);
+    }
+    inline tensor3d_slice_t <const T> operator[](const uint32 i) const {
+      return tensor3d_slice_t <const T> (&m_data[i*m_d2*m_d3],m_d2,m_d3);
+    }
+    inline uint32 size(void) const {
+      return m_d1;
+    }
+    // Direct access to the underlying storage for kernels that want to
+    // stream the contiguous time dimension without going through the
+    // proxies.
+    inline T * row_ptr(const uint32 i,const uint32 k) {
+      return &m_data[i*m_d2*m_d3+k*m_d2];
+    }
+    inline const T * row_ptr(const uint32 i,const uint32 k) const {
+      return &m_data[i*m_d2*m_d3+k*m_d2];
+    }
+  private:
+    uint32 m_d1;
+    uint32 m_d2;
+    uint32 m_d3;
+    std::vector <T> m_data;
+};
+
+#endif
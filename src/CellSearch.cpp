@@ -20,6 +20,8 @@
 #include <getopt.h>
 #include <itpp/itbase.h>
 #include <boost/math/special_functions/gamma.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition.hpp>
 #include <list>
 #include <sstream>
 #include <curses.h>
@@ -52,21 +54,31 @@ void print_usage() {
   cout << "      reduce status messages from program" << endl;
   cout << "    -i --device-index N" << endl;
   cout << "      specify which attached RTLSDR dongle to use" << endl;
+  cout << "    -j --num-devices N" << endl;
+  cout << "      open dongles 0 through N-1 and scan the frequency range in parallel" << endl;
   cout << "  Frequency search options:" << endl;
   cout << "    -s --freq-start fs" << endl;
   cout << "      frequency where cell search should start" << endl;
   cout << "    -e --freq-end fe" << endl;
   cout << "      frequency where cell search should end" << endl;
+  cout << "    -t --two-stage" << endl;
+  cout << "      localize frequency offsets with a fast coarse pass before searching" << endl;
+  cout << "    -m --min-power floor" << endl;
+  cout << "      skip a frequency when its strongest correlation is below 'floor' dB" << endl;
   cout << "  Dongle LO correction options:" << endl;
   cout << "    -p --ppm ppm" << endl;
   cout << "      crystal remaining PPM error" << endl;
   cout << "    -c --correction c" << endl;
   cout << "      crystal correction factor" << endl;
   cout << "  Capture buffer save/ load options:" << endl;
+  cout << "    -a --continuous" << endl;
+  cout << "      stream the dongle continuously and serve windows from a rolling ring" << endl;
   cout << "    -r --record" << endl;
   cout << "      save captured data in the files capbuf_XXXX.it" << endl;
   cout << "    -l --load" << endl;
   cout << "      used data in capbuf_XXXX.it files instead of live data" << endl;
+  cout << "    -w --raw" << endl;
+  cout << "      use the raw capbuf_XXXX.raw file format for --record/ --load" << endl;
   cout << "    -d --data-dir dir" << endl;
   cout << "      directory where capbuf_XXXX.it files are located" << endl << endl;
   cout << "'c' is the correction factor to apply and indicates that if the desired" << endl;
@@ -100,8 +112,13 @@ void parse_commandline(
   double & correction,
   bool & save_cap,
   bool & use_recorded_data,
+  bool & use_raw_format,
   string & data_dir,
-  int & device_index
+  int & device_index,
+  int & num_devices,
+  bool & two_stage,
+  double & power_floor_db,
+  bool & use_continuous
 ) {
   // Default values
   freq_start=-1;
@@ -110,8 +127,13 @@ void parse_commandline(
   correction=1;
   save_cap=false;
   use_recorded_data=false;
+  use_raw_format=false;
   data_dir=".";
   device_index=-1;
+  num_devices=1;
+  two_stage=false;
+  power_floor_db=-INFINITY;
+  use_continuous=false;
 
   while (1) {
     static struct option long_options[] = {
@@ -124,13 +146,18 @@ void parse_commandline(
       {"correction",   required_argument, 0, 'c'},
       {"record",       no_argument,       0, 'r'},
       {"load",         no_argument,       0, 'l'},
+      {"raw",          no_argument,       0, 'w'},
       {"data-dir",     required_argument, 0, 'd'},
       {"device-index", required_argument, 0, 'i'},
+      {"num-devices",  required_argument, 0, 'j'},
+      {"two-stage",    no_argument,       0, 't'},
+      {"min-power",    required_argument, 0, 'm'},
+      {"continuous",   no_argument,       0, 'a'},
       {0, 0, 0, 0}
     };
     /* getopt_long stores the option index here. */
     int option_index = 0;
-    int c = getopt_long (argc, argv, "hvbs:e:p:c:rld:i:",
+    int c = getopt_long (argc, argv, "hvbs:e:p:c:rlwd:i:j:tm:a",
                      long_options, &option_index);
 
     /* Detect the end of the options. */
@@ -189,6 +216,22 @@ void parse_commandline(
       case 'l':
         use_recorded_data=true;
         break;
+      case 'w':
+        use_raw_format=true;
+        break;
+      case 't':
+        two_stage=true;
+        break;
+      case 'a':
+        use_continuous=true;
+        break;
+      case 'm':
+        power_floor_db=strtod(optarg,&endp);
+        if ((optarg==endp)||(*endp!='\0')) {
+          cerr << "Error: could not parse minimum power" << endl;
+          ABORT(-1);
+        }
+        break;
       case 'd':
         data_dir=optarg;
         break;
@@ -203,6 +246,17 @@ void parse_commandline(
           ABORT(-1);
         }
         break;
+      case 'j':
+        num_devices=strtol(optarg,&endp,10);
+        if ((optarg==endp)||(*endp!='\0')) {
+          cerr << "Error: could not parse number of devices" << endl;
+          ABORT(-1);
+        }
+        if (num_devices<1) {
+          cerr << "Error: number of devices must be at least 1" << endl;
+          ABORT(-1);
+        }
+        break;
       case '?':
         /* getopt_long already printed an error message. */
         ABORT(-1);
@@ -260,6 +314,29 @@ void parse_commandline(
     cerr << "Error: cannot read and write captured data at the same time!" << endl;
     ABORT(-1);
   }
+  // The raw file format only matters when captured data is being saved
+  // or loaded.
+  if (use_raw_format&&!(save_cap||use_recorded_data)) {
+    cerr << "Error: --raw has no effect without --record or --load" << endl;
+    ABORT(-1);
+  }
+  // Continuous mode serves windows straight out of the live stream.
+  if (use_continuous&&(save_cap||use_recorded_data)) {
+    cerr << "Error: cannot read or write captured data in continuous capture mode" << endl;
+    ABORT(-1);
+  }
+  // Multi-device scans always use dongles 0 through N-1 and cannot use
+  // recorded data.
+  if (num_devices>1) {
+    if (save_cap||use_recorded_data) {
+      cerr << "Error: cannot read or write captured data in multi-device mode" << endl;
+      ABORT(-1);
+    }
+    if (device_index!=-1) {
+      cerr << "Error: cannot specify both --device-index and --num-devices" << endl;
+      ABORT(-1);
+    }
+  }
 
   if (verbosity>=1) {
     cout << "LTE CellSearch v" << MAJOR_VERSION << "." << MINOR_VERSION << "." << PATCH_LEVEL << " (" << BUILD_TYPE << ") beginning" << endl;
@@ -273,9 +350,11 @@ void parse_commandline(
     temp << setprecision(20) << correction;
     cout << "  correction: " << temp.str() << endl;
     if (save_cap)
-      cout << "  Captured data will be saved in capbufXXXX.it files" << endl;
+      cout << "  Captured data will be saved in capbufXXXX" << (use_raw_format?".raw":".it") << " files" << endl;
     if (use_recorded_data)
-      cout << "  Captured data will be read from capbufXXXX.it files" << endl;
+      cout << "  Captured data will be read from capbufXXXX" << (use_raw_format?".raw":".it") << " files" << endl;
+    if (isfinite(power_floor_db))
+      cout << "  Minimum correlation power: " << power_floor_db << " dB" << endl;
   }
 }
 
@@ -433,6 +512,367 @@ void config_usb(
   free(buffer);
 }
 
+// Run the full searcher chain (PSS correlation through MIB decode) on
+// one capture buffer and return the confirmed cells.
+void search_buffer(
+  // Inputs
+  const cvec & capbuf,
+  const double & fc_requested,
+  const double & fc_programmed,
+  const double & fs_programmed,
+  const vec & f_search_set,
+  const double & power_floor_db,
+  // Outputs
+  list <Cell> & detected_cells
+) {
+  // Correlate
+#define DS_COMB_ARM 2
+  mat xc_incoherent_collapsed_pow;
+  imat xc_incoherent_collapsed_frq;
+  vf3d xc_incoherent_single;
+  vf3d xc_incoherent;
+  vec sp_incoherent;
+  vcf3d xc;
+  vec sp;
+  uint16 n_comb_xc;
+  uint16 n_comb_sp;
+  if (verbosity>=2) {
+    cout << "  Calculating PSS correlations" << endl;
+  }
+  xcorr_pss(capbuf,f_search_set,DS_COMB_ARM,fc_requested,fc_programmed,fs_programmed,xc_incoherent_collapsed_pow,xc_incoherent_collapsed_frq,xc_incoherent_single,xc_incoherent,sp_incoherent,xc,sp,n_comb_xc,n_comb_sp);
+
+  // Calculate the threshold vector
+  const uint8 thresh1_n_nines=12;
+  double R_th1=chi2cdf_inv(1-pow(10.0,-thresh1_n_nines),2*n_comb_xc*(2*DS_COMB_ARM+1));
+  double rx_cutoff=(6*12*15e3/2+4*15e3)/(FS_LTE/16/2);
+  vec Z_th1=R_th1*sp_incoherent/rx_cutoff/137/2/n_comb_xc/(2*DS_COMB_ARM+1);
+
+  // Absolute floor on the correlation surface. In a full band sweep
+  // most center frequencies carry no LTE signal at all but would still
+  // pay for SSS detection and TFG extraction on whatever noise peaks
+  // happen to clear the statistical threshold. If even the strongest
+  // bin on the surface is below the floor, give up on this buffer
+  // before the expensive stages run.
+  if (db10(max(max(xc_incoherent_collapsed_pow)))<power_floor_db) {
+    if (verbosity>=2) {
+      cout << "  Strongest correlation below the power floor; skipping" << endl;
+    }
+    detected_cells.clear();
+    return;
+  }
+
+  // Search for the peaks
+  if (verbosity>=2) {
+    cout << "  Searching for and examining correlation peaks..." << endl;
+  }
+  list <Cell> peak_search_cells;
+  peak_search(xc_incoherent_collapsed_pow,xc_incoherent_collapsed_frq,Z_th1,f_search_set,fc_requested,fc_programmed,xc_incoherent_single,DS_COMB_ARM,peak_search_cells);
+  detected_cells=peak_search_cells;
+
+  // Loop and check each peak
+  list<Cell>::iterator iterator=detected_cells.begin();
+  while (iterator!=detected_cells.end()) {
+    //cout << "Further examining: " << endl;
+    //cout << (*iterator) << endl << endl;
+
+    // Detect SSS if possible
+    vec sss_h1_np_est_meas;
+    vec sss_h2_np_est_meas;
+    cvec sss_h1_nrm_est_meas;
+    cvec sss_h2_nrm_est_meas;
+    cvec sss_h1_ext_est_meas;
+    cvec sss_h2_ext_est_meas;
+    mat log_lik_nrm;
+    mat log_lik_ext;
+#define THRESH2_N_SIGMA 3
+    (*iterator)=sss_detect((*iterator),capbuf,THRESH2_N_SIGMA,fc_requested,fc_programmed,fs_programmed,sss_h1_np_est_meas,sss_h2_np_est_meas,sss_h1_nrm_est_meas,sss_h2_nrm_est_meas,sss_h1_ext_est_meas,sss_h2_ext_est_meas,log_lik_nrm,log_lik_ext);
+    if ((*iterator).n_id_1==-1) {
+      // No SSS detected.
+      iterator=detected_cells.erase(iterator);
+      continue;
+    }
+
+    // Fine FOE
+    (*iterator)=pss_sss_foe((*iterator),capbuf,fc_requested,fc_programmed,fs_programmed);
+
+    // Extract time and frequency grid
+    cmat tfg;
+    vec tfg_timestamp;
+    extract_tfg((*iterator),capbuf,fc_requested,fc_programmed,fs_programmed,tfg,tfg_timestamp);
+
+    // Create object containing all RS
+    RS_DL rs_dl((*iterator).n_id_cell(),6,(*iterator).cp_type);
+
+    // Compensate for time and frequency offsets
+    cmat tfg_comp;
+    vec tfg_comp_timestamp;
+    (*iterator)=tfoec((*iterator),tfg,tfg_timestamp,fc_requested,fc_programmed,rs_dl,tfg_comp,tfg_comp_timestamp);
+
+    // Finally, attempt to decode the MIB
+    (*iterator)=decode_mib((*iterator),tfg_comp,rs_dl);
+    if ((*iterator).n_rb_dl==-1) {
+      // No MIB could be successfully decoded.
+      iterator=detected_cells.erase(iterator);
+      continue;
+    }
+
+    if (verbosity>=1) {
+      cout << "  Detected a cell!" << endl;
+      cout << "    cell ID: " << (*iterator).n_id_cell() << endl;
+      cout << "    RX power level: " << db10((*iterator).pss_pow) << " dB" << endl;
+      cout << "    residual frequency offset: " << (*iterator).freq_superfine << " Hz" << endl;
+    }
+
+    // peak_search returns the peaks strongest first. Once a MIB has
+    // been decoded on a peak that towers over everything still left on
+    // the surface, the remaining entries are sidelobes and noise
+    // around the cell just confirmed; examining them costs a full
+    // SSS/ TFG pass each and essentially never finds anything.
+#define PEAK_DOMINANCE_DB 8
+    list <Cell>::iterator remainder=iterator;
+    ++remainder;
+    if (
+      (remainder!=detected_cells.end()) &&
+      (db10((*iterator).pss_pow)-db10((*remainder).pss_pow)>PEAK_DOMINANCE_DB)
+    ) {
+      if (verbosity>=2) {
+        cout << "  Decoded peak dominates the surface; skipping the weaker peaks" << endl;
+      }
+      detected_cells.erase(remainder,detected_cells.end());
+    }
+
+    ++iterator;
+  }
+}
+
+// Two-stage frequency search. A coarse pass correlates a decimated
+// frequency grid (every third hypothesis, i.e. 15kHz spacing on the
+// default 5kHz grid) against only the first quarter of the capture to
+// localize candidate frequency offsets; the full chain then runs with
+// the hypothesis set restricted to a narrow window around the
+// survivors. After oscillator warm-up the true offset is stable within
+// a few kHz, so the coarse pass typically eliminates most of the grid.
+//
+// The PSS correlation peaks are several kHz wide, so a 15kHz coarse
+// grid cannot step over a detectable cell; the shortened capture only
+// costs combining gain, which the fine pass restores.
+void search_buffer_two_stage(
+  // Inputs
+  const cvec & capbuf,
+  const double & fc_requested,
+  const double & fc_programmed,
+  const double & fs_programmed,
+  const vec & f_search_set,
+  const double & power_floor_db,
+  // Outputs
+  list <Cell> & detected_cells
+) {
+  const uint16 n_f=length(f_search_set);
+
+  // Small hypothesis sets are not worth staging.
+  if (n_f<9) {
+    search_buffer(capbuf,fc_requested,fc_programmed,fs_programmed,f_search_set,power_floor_db,detected_cells);
+    return;
+  }
+
+  // Decimate the frequency grid, always retaining the endpoints.
+  vec f_coarse(n_f);
+  uint16 n_coarse=0;
+  for (uint16 t=0;t<n_f;t+=3) {
+    f_coarse(n_coarse++)=f_search_set(t);
+  }
+  if (mod(n_f-1,3)!=0) {
+    f_coarse(n_coarse++)=f_search_set(n_f-1);
+  }
+  f_coarse.set_size(n_coarse,true);
+
+  // Shortened capture for the coarse pass. 48000 samples give the
+  // correlator 4 combining periods.
+  const cvec capbuf_short=capbuf(0,47999);
+
+  // Coarse correlation and peak search.
+  if (verbosity>=2) {
+    cout << "  Coarse pass over " << n_coarse << " of " << n_f << " hypotheses" << endl;
+  }
+  mat xc_incoherent_collapsed_pow;
+  imat xc_incoherent_collapsed_frq;
+  vf3d xc_incoherent_single;
+  vf3d xc_incoherent;
+  vec sp_incoherent;
+  vcf3d xc;
+  vec sp;
+  uint16 n_comb_xc;
+  uint16 n_comb_sp;
+  xcorr_pss(capbuf_short,f_coarse,DS_COMB_ARM,fc_requested,fc_programmed,fs_programmed,xc_incoherent_collapsed_pow,xc_incoherent_collapsed_frq,xc_incoherent_single,xc_incoherent,sp_incoherent,xc,sp,n_comb_xc,n_comb_sp);
+  const uint8 thresh1_n_nines=12;
+  double R_th1=chi2cdf_inv(1-pow(10.0,-thresh1_n_nines),2*n_comb_xc*(2*DS_COMB_ARM+1));
+  double rx_cutoff=(6*12*15e3/2+4*15e3)/(FS_LTE/16/2);
+  vec Z_th1=R_th1*sp_incoherent/rx_cutoff/137/2/n_comb_xc/(2*DS_COMB_ARM+1);
+
+  // The power floor applies to the coarse surface as well and spares
+  // even the coarse peak search when a frequency is empty.
+  if (db10(max(max(xc_incoherent_collapsed_pow)))<power_floor_db) {
+    if (verbosity>=2) {
+      cout << "  Strongest coarse correlation below the power floor; skipping" << endl;
+    }
+    detected_cells.clear();
+    return;
+  }
+
+  list <Cell> coarse_cells;
+  peak_search(xc_incoherent_collapsed_pow,xc_incoherent_collapsed_frq,Z_th1,f_coarse,fc_requested,fc_programmed,xc_incoherent_single,DS_COMB_ARM,coarse_cells);
+
+  detected_cells.clear();
+  if (coarse_cells.size()==0) {
+    // Nothing resembling a PSS anywhere in the coarse grid.
+    return;
+  }
+
+  // Restrict the full resolution search to hypotheses within 10kHz of
+  // a coarse survivor.
+  vec f_fine(n_f);
+  uint16 n_fine=0;
+  for (uint16 t=0;t<n_f;t++) {
+    list <Cell>::const_iterator it=coarse_cells.begin();
+    while (it!=coarse_cells.end()) {
+      if (abs(f_search_set(t)-(*it).freq)<=10e3) {
+        f_fine(n_fine++)=f_search_set(t);
+        break;
+      }
+      ++it;
+    }
+  }
+  f_fine.set_size(n_fine,true);
+
+  if (verbosity>=2) {
+    cout << "  Fine pass over " << n_fine << " of " << n_f << " hypotheses" << endl;
+  }
+  search_buffer(capbuf,fc_requested,fc_programmed,fs_programmed,f_fine,power_floor_db,detected_cells);
+}
+
+// State shared between the capture thread and the search loop in main().
+// A single buffer slot is enough for double buffering: the capture
+// thread fills the slot for frequency n+1 while main() is still
+// processing the (copied out) buffer for frequency n.
+typedef struct {
+  boost::mutex mutex;
+  boost::condition condition;
+  // True while a filled buffer is waiting to be picked up by main().
+  bool buf_ready;
+  // Filled in by the capture thread.
+  itpp::cvec capbuf;
+  double fc_requested;
+  double fc_programmed;
+} capture_pipeline_t;
+
+// Captures (or loads from disk) a buffer for every center frequency in
+// the search set, in order, and hands each buffer off to main(). Tuning
+// and the 80ms capture happen here while main() runs the searcher chain
+// on the previous buffer, so the radio dead time is hidden behind the
+// signal processing.
+void capture_thread(
+  capture_pipeline_t & pipeline,
+  const vec & fc_search_set,
+  const double & correction,
+  const bool & save_cap,
+  const bool & use_recorded_data,
+  const bool & use_raw_format,
+  const string & data_dir,
+  const bool & use_continuous,
+  rtlsdr_dev_t * & dev
+) {
+  const uint16 n_fc=length(fc_search_set);
+  capture_ring_t ring;
+  for (uint16 fci=0;fci<n_fc;fci++) {
+    const double fc_requested=fc_search_set(fci);
+
+    // Fill capture buffer
+    cvec capbuf;
+    double fc_programmed;
+    if (use_continuous) {
+      capture_data_continuous(fc_requested,correction,dev,ring,capbuf,fc_programmed);
+    } else {
+      capture_data(fc_requested,correction,save_cap,use_recorded_data,use_raw_format,data_dir,dev,capbuf,fc_programmed);
+    }
+
+    // Wait until the previous buffer has been picked up and then
+    // publish this one.
+    boost::mutex::scoped_lock lock(pipeline.mutex);
+    while (pipeline.buf_ready) {
+      pipeline.condition.wait(lock);
+    }
+    pipeline.capbuf=capbuf;
+    pipeline.fc_requested=fc_requested;
+    pipeline.fc_programmed=fc_programmed;
+    pipeline.buf_ready=true;
+    pipeline.condition.notify_one();
+  }
+  capture_ring_stop(ring);
+}
+
+// Queue of center frequency indexes that remain to be searched.
+// Shared by the workers in multi-device mode.
+typedef struct {
+  boost::mutex mutex;
+  uint16 next_fci;
+} scan_work_queue_t;
+
+// Worker for the multi-device scanning mode. Each worker owns one
+// dongle and repeatedly claims the next unsearched center frequency
+// from the shared queue, captures on its own device, and runs the full
+// searcher chain. The dynamic queue keeps all dongles busy even when
+// some frequencies need tuning retries.
+void scan_worker_thread(
+  scan_work_queue_t & work_queue,
+  const vec & fc_search_set,
+  const vec & f_search_set,
+  const double & correction,
+  const string & data_dir,
+  rtlsdr_dev_t * & dev,
+  const double & fs_programmed,
+  const bool & two_stage,
+  const double & power_floor_db,
+  const bool & use_continuous,
+  vector < list<Cell> > & detected_cells
+) {
+  const uint16 n_fc=length(fc_search_set);
+  capture_ring_t ring;
+  while (true) {
+    // Claim the next center frequency.
+    uint16 fci;
+    {
+      boost::mutex::scoped_lock lock(work_queue.mutex);
+      if (work_queue.next_fci>=n_fc)
+        break;
+      fci=work_queue.next_fci++;
+    }
+    const double fc_requested=fc_search_set(fci);
+
+    if (verbosity>=1) {
+      cout << "Examining center frequency " << fc_requested/1e6 << " MHz ..." << endl;
+    }
+
+    // Saving and loading of capture buffers is not supported in
+    // multi-device mode.
+    cvec capbuf;
+    double fc_programmed;
+    if (use_continuous) {
+      capture_data_continuous(fc_requested,correction,dev,ring,capbuf,fc_programmed);
+    } else {
+      capture_data(fc_requested,correction,false,false,false,data_dir,dev,capbuf,fc_programmed);
+    }
+
+    // Each fci is claimed by exactly one worker, so the workers write
+    // to disjoint entries of detected_cells and no lock is needed.
+    if (two_stage) {
+      search_buffer_two_stage(capbuf,fc_requested,fc_programmed,fs_programmed,f_search_set,power_floor_db,detected_cells[fci]);
+    } else {
+      search_buffer(capbuf,fc_requested,fc_programmed,fs_programmed,f_search_set,power_floor_db,detected_cells[fci]);
+    }
+  }
+  capture_ring_stop(ring);
+}
+
 // Main cell search routine.
 int main(
   const int argc,
@@ -445,17 +885,32 @@ int main(
   double correction;
   bool save_cap;
   bool use_recorded_data;
+  bool use_raw_format;
   string data_dir;
   int32 device_index;
+  int32 num_devices;
+  bool two_stage;
+  double power_floor_db;
+  bool use_continuous;
 
   // Get search parameters from user
-  parse_commandline(argc,argv,freq_start,freq_end,ppm,correction,save_cap,use_recorded_data,data_dir,device_index);
+  parse_commandline(argc,argv,freq_start,freq_end,ppm,correction,save_cap,use_recorded_data,use_raw_format,data_dir,device_index,num_devices,two_stage,power_floor_db,use_continuous);
 
-  // Open the USB device (if necessary).
-  rtlsdr_dev_t * dev=NULL;
-  double fs_programmed;
-  if (!use_recorded_data)
-    config_usb(correction,device_index,freq_start,dev,fs_programmed);
+  // Pre-plan the FFT's and persist FFTW wisdom across invocations.
+  fft_wisdom_init(data_dir);
+
+  // Open the USB device(s) (if necessary).
+  vector <rtlsdr_dev_t *> dev(num_devices,(rtlsdr_dev_t *)NULL);
+  vector <double> fs_programmed(num_devices,0.0);
+  if (!use_recorded_data) {
+    if (num_devices==1) {
+      config_usb(correction,device_index,freq_start,dev[0],fs_programmed[0]);
+    } else {
+      for (int32 t=0;t<num_devices;t++) {
+        config_usb(correction,t,freq_start,dev[t],fs_programmed[t]);
+      }
+    }
+  }
 
   // Generate a list of center frequencies that should be searched and also
   // a list of frequency offsets that should be searched for each center
@@ -467,105 +922,61 @@ int main(
   // Each center frequency is searched independently. Results are stored in
   // this vector.
   vector < list<Cell> > detected_cells(n_fc);
-  // Loop for each center frequency.
-  for (uint16 fci=0;fci<n_fc;fci++) {
-    double fc_requested=fc_search_set(fci);
 
-    if (verbosity>=1) {
-      cout << "Examining center frequency " << fc_requested/1e6 << " MHz ..." << endl;
+  if (num_devices>1) {
+    // Multi-device scan: one worker per dongle, all pulling center
+    // frequencies from a shared queue.
+    scan_work_queue_t work_queue;
+    work_queue.next_fci=0;
+    vector <boost::thread *> workers(num_devices);
+    for (int32 t=0;t<num_devices;t++) {
+      workers[t]=new boost::thread(scan_worker_thread,boost::ref(work_queue),boost::ref(fc_search_set),boost::ref(f_search_set),boost::ref(correction),boost::ref(data_dir),boost::ref(dev[t]),boost::ref(fs_programmed[t]),boost::ref(two_stage),boost::ref(power_floor_db),boost::ref(use_continuous),boost::ref(detected_cells));
     }
-
-    // Fill capture buffer
-    cvec capbuf;
-    double fc_programmed;
-    capture_data(fc_requested,correction,save_cap,use_recorded_data,data_dir,dev,capbuf,fc_programmed);
-
-    // Correlate
-#define DS_COMB_ARM 2
-    mat xc_incoherent_collapsed_pow;
-    imat xc_incoherent_collapsed_frq;
-    vf3d xc_incoherent_single;
-    vf3d xc_incoherent;
-    vec sp_incoherent;
-    vcf3d xc;
-    vec sp;
-    uint16 n_comb_xc;
-    uint16 n_comb_sp;
-    if (verbosity>=2) {
-      cout << "  Calculating PSS correlations" << endl;
+    for (int32 t=0;t<num_devices;t++) {
+      workers[t]->join();
+      delete workers[t];
     }
-    xcorr_pss(capbuf,f_search_set,DS_COMB_ARM,fc_requested,fc_programmed,fs_programmed,xc_incoherent_collapsed_pow,xc_incoherent_collapsed_frq,xc_incoherent_single,xc_incoherent,sp_incoherent,xc,sp,n_comb_xc,n_comb_sp);
+  } else {
+    // Launch the capture thread. It captures the buffer for the next
+    // center frequency while this thread searches the current one.
+    capture_pipeline_t pipeline;
+    pipeline.buf_ready=false;
+    boost::thread capture_thr(capture_thread,boost::ref(pipeline),boost::ref(fc_search_set),boost::ref(correction),boost::ref(save_cap),boost::ref(use_recorded_data),boost::ref(use_raw_format),boost::ref(data_dir),boost::ref(use_continuous),boost::ref(dev[0]));
 
-    // Calculate the threshold vector
-    const uint8 thresh1_n_nines=12;
-    double R_th1=chi2cdf_inv(1-pow(10.0,-thresh1_n_nines),2*n_comb_xc*(2*DS_COMB_ARM+1));
-    double rx_cutoff=(6*12*15e3/2+4*15e3)/(FS_LTE/16/2);
-    vec Z_th1=R_th1*sp_incoherent/rx_cutoff/137/2/n_comb_xc/(2*DS_COMB_ARM+1);
+    // Loop for each center frequency.
+    for (uint16 fci=0;fci<n_fc;fci++) {
+      double fc_requested=fc_search_set(fci);
 
-    // Search for the peaks
-    if (verbosity>=2) {
-      cout << "  Searching for and examining correlation peaks..." << endl;
-    }
-    list <Cell> peak_search_cells;
-    peak_search(xc_incoherent_collapsed_pow,xc_incoherent_collapsed_frq,Z_th1,f_search_set,fc_requested,fc_programmed,xc_incoherent_single,DS_COMB_ARM,peak_search_cells);
-    detected_cells[fci]=peak_search_cells;
-
-    // Loop and check each peak
-    list<Cell>::iterator iterator=detected_cells[fci].begin();
-    while (iterator!=detected_cells[fci].end()) {
-      //cout << "Further examining: " << endl;
-      //cout << (*iterator) << endl << endl;
-
-      // Detect SSS if possible
-      vec sss_h1_np_est_meas;
-      vec sss_h2_np_est_meas;
-      cvec sss_h1_nrm_est_meas;
-      cvec sss_h2_nrm_est_meas;
-      cvec sss_h1_ext_est_meas;
-      cvec sss_h2_ext_est_meas;
-      mat log_lik_nrm;
-      mat log_lik_ext;
-#define THRESH2_N_SIGMA 3
-      (*iterator)=sss_detect((*iterator),capbuf,THRESH2_N_SIGMA,fc_requested,fc_programmed,fs_programmed,sss_h1_np_est_meas,sss_h2_np_est_meas,sss_h1_nrm_est_meas,sss_h2_nrm_est_meas,sss_h1_ext_est_meas,sss_h2_ext_est_meas,log_lik_nrm,log_lik_ext);
-      if ((*iterator).n_id_1==-1) {
-        // No SSS detected.
-        iterator=detected_cells[fci].erase(iterator);
-        continue;
+      if (verbosity>=1) {
+        cout << "Examining center frequency " << fc_requested/1e6 << " MHz ..." << endl;
       }
 
-      // Fine FOE
-      (*iterator)=pss_sss_foe((*iterator),capbuf,fc_requested,fc_programmed,fs_programmed);
-
-      // Extract time and frequency grid
-      cmat tfg;
-      vec tfg_timestamp;
-      extract_tfg((*iterator),capbuf,fc_requested,fc_programmed,fs_programmed,tfg,tfg_timestamp);
-
-      // Create object containing all RS
-      RS_DL rs_dl((*iterator).n_id_cell(),6,(*iterator).cp_type);
-
-      // Compensate for time and frequency offsets
-      cmat tfg_comp;
-      vec tfg_comp_timestamp;
-      (*iterator)=tfoec((*iterator),tfg,tfg_timestamp,fc_requested,fc_programmed,rs_dl,tfg_comp,tfg_comp_timestamp);
-
-      // Finally, attempt to decode the MIB
-      (*iterator)=decode_mib((*iterator),tfg_comp,rs_dl);
-      if ((*iterator).n_rb_dl==-1) {
-        // No MIB could be successfully decoded.
-        iterator=detected_cells[fci].erase(iterator);
-        continue;
+      // Pick up the capture buffer for this center frequency. The capture
+      // thread delivers the buffers in search set order.
+      cvec capbuf;
+      double fc_programmed;
+      {
+        boost::mutex::scoped_lock lock(pipeline.mutex);
+        while (!pipeline.buf_ready) {
+          pipeline.condition.wait(lock);
+        }
+        ASSERT(pipeline.fc_requested==fc_requested);
+        capbuf=pipeline.capbuf;
+        fc_programmed=pipeline.fc_programmed;
+        pipeline.buf_ready=false;
+        pipeline.condition.notify_one();
       }
 
-      if (verbosity>=1) {
-        cout << "  Detected a cell!" << endl;
-        cout << "    cell ID: " << (*iterator).n_id_cell() << endl;
-        cout << "    RX power level: " << db10((*iterator).pss_pow) << " dB" << endl;
-        cout << "    residual frequency offset: " << (*iterator).freq_superfine << " Hz" << endl;
+      // Run the searcher chain on this buffer.
+      if (two_stage) {
+        search_buffer_two_stage(capbuf,fc_requested,fc_programmed,fs_programmed[0],f_search_set,power_floor_db,detected_cells[fci]);
+      } else {
+        search_buffer(capbuf,fc_requested,fc_programmed,fs_programmed[0],f_search_set,power_floor_db,detected_cells[fci]);
       }
-
-      ++iterator;
     }
+
+    // All buffers have been delivered and processed.
+    capture_thr.join();
   }
 
   // Generate final list of detected cells.
@@ -80,6 +80,13 @@ void print_usage() {
   cout << "      crystal remaining PPM error" << endl;
   cout << "    -c --correction c" << endl;
   cout << "      crystal correction factor" << endl;
+  cout << "  Monitoring options:" << endl;
+  cout << "    -t --stats-file filename" << endl;
+  cout << "      append a performance counter line to this file about once per second" << endl;
+  cout << "  Performance options:" << endl;
+  cout << "    -u --search-duty fraction" << endl;
+  cout << "      fraction of a CPU the searcher may use while cells are being tracked" << endl;
+  cout << "      (0..1, default 0.25; 1 runs the searcher at full speed)" << endl;
   // Hidden option...
   //cout << "    -x --expert" << endl;
   //cout << "      enable expert mode display" << endl;
@@ -126,10 +133,14 @@ void parse_commandline(
   bool & repeat,
   double & drop_secs,
   bool & rtl_sdr_format,
-  double & noise_power
+  double & noise_power,
+  string & stats_filename,
+  double & search_duty
 ) {
   // Default values
   fc=-1;
+  stats_filename="";
+  search_duty=0.25;
   ppm=120;
   correction=1;
   device_index=-1;
@@ -155,6 +166,8 @@ void parse_commandline(
       {"drop",         required_argument, 0, 'd'},
       {"rtl_sdr",      no_argument,       0, 's'},
       {"noise-power",  required_argument, 0, 'n'},
+      {"stats-file",   required_argument, 0, 't'},
+      {"search-duty",  required_argument, 0, 'u'},
       {"g1",           required_argument, 0, '1'},
       {"g2",           required_argument, 0, '2'},
       {"g3",           required_argument, 0, '3'},
@@ -168,7 +181,7 @@ void parse_commandline(
     };
     /* getopt_long stores the option index here. */
     int option_index = 0;
-    int c = getopt_long (argc, argv, "hvbf:p:c:i:xl:rd:sn:1:2:3:4:5:6:7:8:9:",
+    int c = getopt_long (argc, argv, "hvbf:p:c:i:xl:rd:sn:t:u:1:2:3:4:5:6:7:8:9:",
                      long_options, &option_index);
 
     /* Detect the end of the options. */
@@ -253,6 +266,20 @@ void parse_commandline(
           ABORT(-1);
         }
         break;
+      case 't':
+        stats_filename=optarg;
+        break;
+      case 'u':
+        search_duty=strtod(optarg,&endp);
+        if ((optarg==endp)||(*endp!='\0')) {
+          cerr << "Error: could not parse search duty cycle" << endl;
+          ABORT(-1);
+        }
+        if ((search_duty<=0)||(search_duty>1)) {
+          cerr << "Error: search duty cycle must be greater than 0 and at most 1" << endl;
+          ABORT(-1);
+        }
+        break;
       case '1':
         global_1=strtod(optarg,&endp);
         if ((optarg==endp)||(*endp!='\0')) {
@@ -608,7 +635,7 @@ double kalibrate(
       }
       fc_programmed=fc_requested;
     } else {
-      capture_data(fc_requested,1.0,false,false,".",dev,capbuf,fc_programmed);
+      capture_data(fc_requested,1.0,false,false,false,".",dev,capbuf,fc_programmed);
     }
     //cout << "Capbuf power: " << db10(sigpower(capbuf)) << " dB" << endl;
     if (noise_power)
@@ -754,12 +781,11 @@ static void rtlsdr_callback(
     ABORT(-1);
   }
 
-  boost::mutex::scoped_lock lock(sampbuf_sync.mutex);
-  for (uint32 t=0;t<len;t++) {
-    sampbuf_sync.fifo.push_back(buf[t]);
-  }
-  sampbuf_sync.fifo_peak_size=MAX(sampbuf_sync.fifo.size(),sampbuf_sync.fifo_peak_size);
-  sampbuf_sync.condition.notify_one();
+  // Lock-free handoff of the whole transfer block to the producer
+  // thread. If the ring is completely full the excess bytes are
+  // dropped, but the producer's backlog dropping starts long before
+  // that can happen.
+  sampbuf_sync.fifo.write(buf,len);
 }
 
 // Main routine.
@@ -779,8 +805,15 @@ int main(
   double drop_secs;
   bool rtl_sdr_format;
   double noise_power;
+  string stats_filename;
+  double search_duty;
   // Get search parameters from the user
-  parse_commandline(argc,argv,fc_requested,ppm,correction,device_index,expert_mode,use_recorded_data,filename,repeat,drop_secs,rtl_sdr_format,noise_power);
+  parse_commandline(argc,argv,fc_requested,ppm,correction,device_index,expert_mode,use_recorded_data,filename,repeat,drop_secs,rtl_sdr_format,noise_power,stats_filename,search_duty);
+
+  // Pre-plan the FFT's and persist FFTW wisdom across invocations. This
+  // program is frequently restarted after config changes and the wisdom
+  // makes planning on later startups nearly free.
+  fft_wisdom_init(".");
 
   // Open the USB device.
   rtlsdr_dev_t * dev=NULL;
@@ -811,6 +844,7 @@ int main(
   */
   global_thread_data.main_thread_id=syscall(SYS_gettid);
   global_thread_data.frequency_offset(initial_freq_offset);
+  global_thread_data.searcher_duty_cycle(search_duty);
 
   // Start the cell searcher thread.
   // Now that the oscillator has been calibrated, we can perform
@@ -819,13 +853,25 @@ int main(
   capbuf_sync.capbuf.set_size(19200*8);
   boost::thread searcher_thr(searcher_thread,boost::ref(capbuf_sync),boost::ref(global_thread_data),boost::ref(tracked_cell_list));
 
-  // Start the producer thread.
-  boost::thread producer_thr(producer_thread,boost::ref(sampbuf_sync),boost::ref(capbuf_sync),boost::ref(global_thread_data),boost::ref(tracked_cell_list),boost::ref(fc_programmed));
+  // Start the tracker worker pool. Cells are serviced by a fixed number
+  // of workers sized to the machine (leaving headroom for the producer,
+  // searcher, and display threads) instead of one thread per cell.
+  tracker_pool_t tracker_pool;
+  uint32 n_cores=boost::thread::hardware_concurrency();
+  if (n_cores==0)
+    n_cores=2;
+  const uint32 n_workers=MAX(1,(int32)n_cores-2);
+  for (uint32 t=0;t<n_workers;t++) {
+    // The thread object may go out of scope; boost detaches the thread,
+    // which runs until the process exits.
+    boost::thread worker_thr(tracker_worker_thread,boost::ref(tracker_pool),boost::ref(global_thread_data));
+  }
 
-  sampbuf_sync.fifo_peak_size=0;
+  // Start the producer thread.
+  boost::thread producer_thr(producer_thread,boost::ref(sampbuf_sync),boost::ref(capbuf_sync),boost::ref(global_thread_data),boost::ref(tracked_cell_list),boost::ref(tracker_pool),boost::ref(fc_programmed));
 
   // Launch the display thread
-  boost::thread display_thr(display_thread,boost::ref(sampbuf_sync),boost::ref(global_thread_data),boost::ref(tracked_cell_list),boost::ref(expert_mode));
+  boost::thread display_thr(display_thread,boost::ref(sampbuf_sync),boost::ref(global_thread_data),boost::ref(tracked_cell_list),boost::ref(expert_mode),boost::ref(stats_filename));
 
   // The remainder of this thread simply copies data received from the USB
   // device (or a file!) to the producer thread. This can be considered
@@ -836,15 +882,17 @@ int main(
     //cout << db10(sigpower(file_data)) << endl;
 
     uint32 offset=0;
+    vector <uint8> chunk;
+    chunk.reserve(2*192000);
     while (true) {
       {
-        boost::mutex::scoped_lock lock(sampbuf_sync.mutex);
+        chunk.clear();
         for (uint32 t=0;t<192000;t++) {
           complex <double> samp=file_data[offset]+randn_c()*sqrt(noise_power);
           uint8 samp_real=RAIL(round_i(real(samp)*128.0+127.0),0,255);
           uint8 samp_imag=RAIL(round_i(imag(samp)*128.0+127.0),0,255);
-          sampbuf_sync.fifo.push_back(samp_real);
-          sampbuf_sync.fifo.push_back(samp_imag);
+          chunk.push_back(samp_real);
+          chunk.push_back(samp_imag);
           offset++;
           if (offset==(unsigned)file_data.length()) {
             if (!repeat) {
@@ -853,7 +901,7 @@ int main(
             offset=0;
           }
         }
-        sampbuf_sync.condition.notify_one();
+        sampbuf_sync.fifo.write(&chunk[0],chunk.size());
       }
       boost::this_thread::sleep(boost::posix_time::milliseconds(100));
       if (!repeat&&(offset==(unsigned)file_data.length())) {
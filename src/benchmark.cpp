@@ -0,0 +1,454 @@
+// Copyright 2012 Evrytania LLC (http://www.evrytania.com)
+//
+// Written by James Peroulas <james@evrytania.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Benchmark driver for the cell searcher chain.
+//
+// Runs each searcher stage repeatedly on two standardized inputs (a
+// recorded capture buffer containing a real cell and a seeded synthetic
+// noise buffer) and reports wall time, samples processed per second,
+// and the number of heap allocations per run. This replaces timing
+// whole CellSearch runs with time(1) when evaluating hardware or
+// checking for performance regressions between releases.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <new>
+#include <atomic>
+#include <itpp/itbase.h>
+#include <boost/math/special_functions/gamma.hpp>
+#include <list>
+#include <iomanip>
+#include <sstream>
+#include <curses.h>
+#include "rtl-sdr.h"
+#include "common.h"
+#include "macros.h"
+#include "lte_lib.h"
+#include "constants.h"
+#include "itpp_ext.h"
+#include "searcher.h"
+#include "dsp.h"
+
+using namespace itpp;
+using namespace std;
+
+uint8 verbosity=0;
+
+// Number of complex samples in one capture buffer. Must match capbuf.cpp.
+#define CAPLENGTH 153600
+
+// Defined in searcher.cpp. Not part of the public searcher interface,
+// but benchmarked separately because it dominates decode_mib.
+void chan_est(
+  const Cell & cell,
+  const RS_DL & rs_dl,
+  const cmat & tfg,
+  const uint8 & port,
+  cmat & ce_tfg,
+  double & np
+);
+
+// Count every heap allocation made by the stage under test, including
+// those inside itpp and the STL, by replacing the global allocation
+// functions. The replaced sized and array forms of operator delete
+// forward to these by default. Several stages allocate from inside
+// OpenMP parallel regions, so the counter must be atomic; relaxed
+// ordering suffices since only the count matters.
+static std::atomic <uint64> n_allocs(0);
+void * operator new(size_t size) {
+  n_allocs.fetch_add(1,std::memory_order_relaxed);
+  void * p=malloc(size);
+  if (p==NULL)
+    throw std::bad_alloc();
+  return p;
+}
+void * operator new[](size_t size) {
+  n_allocs.fetch_add(1,std::memory_order_relaxed);
+  void * p=malloc(size);
+  if (p==NULL)
+    throw std::bad_alloc();
+  return p;
+}
+void operator delete(void * p) noexcept {
+  free(p);
+}
+void operator delete[](void * p) noexcept {
+  free(p);
+}
+
+// Timing results for one stage.
+typedef struct {
+  string name;
+  // Wall time of each repeat, in seconds.
+  vec elapsed;
+  // Allocations performed by the final repeat.
+  uint64 allocs;
+  // Number of complex samples consumed per run. Used to derive the
+  // samples/sec figure; zero suppresses it for stages whose input is
+  // not naturally measured in samples.
+  uint32 n_samples;
+} stage_result_t;
+
+// Print the result table for one input buffer.
+static void report(
+  const string & label,
+  const list <stage_result_t> & results
+) {
+  cout << endl;
+  cout << "Input: " << label << endl;
+  cout << setw(14) << "stage" << setw(12) << "mean (ms)" << setw(12) << "min (ms)" << setw(16) << "samples/sec" << setw(12) << "allocs" << endl;
+  list <stage_result_t>::const_iterator it=results.begin();
+  while (it!=results.end()) {
+    const double mean_s=mean((*it).elapsed);
+    const double min_s=min((*it).elapsed);
+    cout << setw(14) << (*it).name;
+    cout << setw(12) << setprecision(4) << fixed << mean_s*1e3;
+    cout << setw(12) << setprecision(4) << fixed << min_s*1e3;
+    if ((*it).n_samples==0) {
+      cout << setw(16) << "-";
+    } else {
+      cout << setw(16) << setprecision(4) << scientific << (*it).n_samples/mean_s;
+    }
+    cout << setw(12) << (*it).allocs << endl;
+    ++it;
+  }
+  cout.unsetf(ios::floatfield);
+}
+
+// Time one repetition: everything between start() and the matching
+// stop() is attributed to the stage.
+static Real_Timer timer;
+static uint64 allocs_at_start;
+static inline void meas_start(void) {
+  allocs_at_start=n_allocs.load(std::memory_order_relaxed);
+  timer.tic();
+}
+static inline void meas_stop(stage_result_t & result,const uint16 & rep) {
+  result.elapsed(rep)=timer.toc();
+  result.allocs=n_allocs.load(std::memory_order_relaxed)-allocs_at_start;
+}
+
+// Run every searcher stage n_reps times on one capture buffer and
+// append the results. Stages past peak_search need a detected cell and
+// are skipped (with a message) when the input does not contain one.
+static void benchmark_buffer(
+  const string & label,
+  const cvec & capbuf,
+  const double & fc,
+  const double & fs_programmed,
+  const vec & f_search_set,
+  const uint16 & n_reps
+) {
+  list <stage_result_t> results;
+  stage_result_t result;
+  result.elapsed.set_size(n_reps);
+
+  // Correlate
+#define DS_COMB_ARM 2
+  mat xc_incoherent_collapsed_pow;
+  imat xc_incoherent_collapsed_frq;
+  vf3d xc_incoherent_single;
+  vf3d xc_incoherent;
+  vec sp_incoherent;
+  vcf3d xc;
+  vec sp;
+  uint16 n_comb_xc;
+  uint16 n_comb_sp;
+  result.name="xcorr_pss";
+  result.n_samples=length(capbuf);
+  for (uint16 rep=0;rep<n_reps;rep++) {
+    meas_start();
+    xcorr_pss(capbuf,f_search_set,DS_COMB_ARM,fc,fc,fs_programmed,xc_incoherent_collapsed_pow,xc_incoherent_collapsed_frq,xc_incoherent_single,xc_incoherent,sp_incoherent,xc,sp,n_comb_xc,n_comb_sp);
+    meas_stop(result,rep);
+  }
+  results.push_back(result);
+
+  // Calculate the threshold vector
+  const uint8 thresh1_n_nines=12;
+  double R_th1=chi2cdf_inv(1-pow(10.0,-thresh1_n_nines),2*n_comb_xc*(2*DS_COMB_ARM+1));
+  double rx_cutoff=(6*12*15e3/2+4*15e3)/(FS_LTE/16/2);
+  vec Z_th1=R_th1*sp_incoherent/rx_cutoff/137/2/n_comb_xc/(2*DS_COMB_ARM+1);
+
+  // Search for the peaks
+  list <Cell> peaks;
+  result.name="peak_search";
+  result.n_samples=0;
+  for (uint16 rep=0;rep<n_reps;rep++) {
+    // peak_search appends to its output list.
+    peaks.clear();
+    meas_start();
+    peak_search(xc_incoherent_collapsed_pow,xc_incoherent_collapsed_frq,Z_th1,f_search_set,fc,fc,xc_incoherent_single,DS_COMB_ARM,peaks);
+    meas_stop(result,rep);
+  }
+  results.push_back(result);
+
+  // The remaining stages operate on one detected cell.
+  Cell cell;
+  bool have_cell=false;
+  list <Cell>::iterator it=peaks.begin();
+  while (it!=peaks.end()) {
+    // Detect SSS
+    vec sss_h1_np_est;
+    vec sss_h2_np_est;
+    cvec sss_h1_nrm_est;
+    cvec sss_h2_nrm_est;
+    cvec sss_h1_ext_est;
+    cvec sss_h2_ext_est;
+    mat log_lik_nrm;
+    mat log_lik_ext;
+#define THRESH2_N_SIGMA 3
+    result.name="sss_detect";
+    result.n_samples=length(capbuf);
+    for (uint16 rep=0;rep<n_reps;rep++) {
+      meas_start();
+      cell=sss_detect((*it),capbuf,THRESH2_N_SIGMA,fc,fc,fs_programmed,sss_h1_np_est,sss_h2_np_est,sss_h1_nrm_est,sss_h2_nrm_est,sss_h1_ext_est,sss_h2_ext_est,log_lik_nrm,log_lik_ext);
+      meas_stop(result,rep);
+    }
+    if (cell.n_id_1==-1) {
+      // Try the next peak. sss_detect timings for peaks that fail are
+      // discarded so the table always describes one coherent chain.
+      ++it;
+      continue;
+    }
+    results.push_back(result);
+    have_cell=true;
+    break;
+  }
+
+  if (!have_cell) {
+    report(label,results);
+    cout << "(no cell found; downstream stages skipped)" << endl;
+    return;
+  }
+
+  // Fine FOE
+  result.name="pss_sss_foe";
+  result.n_samples=length(capbuf);
+  for (uint16 rep=0;rep<n_reps;rep++) {
+    meas_start();
+    cell=pss_sss_foe(cell,capbuf,fc,fc,fs_programmed);
+    meas_stop(result,rep);
+  }
+  results.push_back(result);
+
+  // Extract time and frequency grid
+  cmat tfg;
+  vec tfg_timestamp;
+  result.name="extract_tfg";
+  result.n_samples=length(capbuf);
+  for (uint16 rep=0;rep<n_reps;rep++) {
+    meas_start();
+    extract_tfg(cell,capbuf,fc,fc,fs_programmed,tfg,tfg_timestamp);
+    meas_stop(result,rep);
+  }
+  results.push_back(result);
+
+  // Create object containing all RS
+  RS_DL rs_dl(cell.n_id_cell(),6,cell.cp_type);
+
+  // Compensate for time and frequency offsets
+  cmat tfg_comp;
+  vec tfg_comp_timestamp;
+  result.name="tfoec";
+  result.n_samples=0;
+  for (uint16 rep=0;rep<n_reps;rep++) {
+    meas_start();
+    cell=tfoec(cell,tfg,tfg_timestamp,fc,fc,rs_dl,tfg_comp,tfg_comp_timestamp);
+    meas_stop(result,rep);
+  }
+  results.push_back(result);
+
+  // Channel estimation for one antenna port. decode_mib below repeats
+  // this for every port; this entry isolates the kernel itself.
+  cmat ce_tfg;
+  double np;
+  result.name="chan_est";
+  result.n_samples=0;
+  for (uint16 rep=0;rep<n_reps;rep++) {
+    meas_start();
+    chan_est(cell,rs_dl,tfg_comp,0,ce_tfg,np);
+    meas_stop(result,rep);
+  }
+  results.push_back(result);
+
+  // Decode the MIB
+  result.name="decode_mib";
+  result.n_samples=0;
+  for (uint16 rep=0;rep<n_reps;rep++) {
+    meas_start();
+    Cell cell_mib=decode_mib(cell,tfg_comp,rs_dl);
+    meas_stop(result,rep);
+    if ((rep==0)&&(cell_mib.n_rb_dl==-1)) {
+      cout << "Warning: MIB could not be decoded from input '" << label << "'" << endl;
+    }
+  }
+  results.push_back(result);
+
+  report(label,results);
+}
+
+// Simple usage screen.
+void print_usage() {
+  cout << "LTE searcher benchmark v" << MAJOR_VERSION << "." << MINOR_VERSION << "." << PATCH_LEVEL << " (" << BUILD_TYPE << ")" << endl << endl;
+  cout << "benchmark -d dir [optional options]" << endl;
+  cout << "  Options:" << endl;
+  cout << "    -h --help" << endl;
+  cout << "      print this help screen" << endl;
+  cout << "    -d --data-dir dir" << endl;
+  cout << "      directory containing the recorded capbuf_0000.it input" << endl;
+  cout << "    -s --freq fc" << endl;
+  cout << "      center frequency of the recorded input (default 739MHz)" << endl;
+  cout << "    -n --reps N" << endl;
+  cout << "      number of repeat runs per stage (default 5)" << endl << endl;
+  cout << "The recorded input exercises the full chain including SSS detection" << endl;
+  cout << "and MIB decoding; a seeded synthetic noise buffer exercises the" << endl;
+  cout << "no-detection path of the correlator and peak search." << endl;
+}
+
+// Parse the command line arguments and return optional parameters as
+// variables.
+void parse_commandline(
+  // Inputs
+  const int & argc,
+  char * const argv[],
+  // Outputs
+  string & data_dir,
+  double & freq,
+  uint16 & n_reps
+) {
+  // Default values
+  data_dir="";
+  freq=739e6;
+  n_reps=5;
+
+  while (1) {
+    static struct option long_options[] = {
+      {"help",     no_argument,       0, 'h'},
+      {"data-dir", required_argument, 0, 'd'},
+      {"freq",     required_argument, 0, 's'},
+      {"reps",     required_argument, 0, 'n'},
+      {0, 0, 0, 0}
+    };
+    /* getopt_long stores the option index here. */
+    int option_index = 0;
+    int c = getopt_long (argc, argv, "hd:s:n:",
+                     long_options, &option_index);
+
+    /* Detect the end of the options. */
+    if (c == -1)
+      break;
+
+    switch (c) {
+      char * endp;
+      case 0:
+        // Code should only get here if a long option was given a non-null
+        // flag value.
+        cout << "Check code!" << endl;
+        ABORT(-1);
+        break;
+      case 'h':
+        print_usage();
+        ABORT(-1);
+        break;
+      case 'd':
+        data_dir=optarg;
+        break;
+      case 's':
+        freq=strtod(optarg,&endp);
+        if ((optarg==endp)||(*endp!='\0')) {
+          cerr << "Error: could not parse frequency" << endl;
+          ABORT(-1);
+        }
+        break;
+      case 'n':
+        n_reps=strtol(optarg,&endp,10);
+        if ((optarg==endp)||(*endp!='\0')||(n_reps<1)) {
+          cerr << "Error: could not parse number of reps" << endl;
+          ABORT(-1);
+        }
+        break;
+      case '?':
+        /* getopt_long already printed an error message. */
+        ABORT(-1);
+      default:
+        ABORT(-1);
+    }
+  }
+
+  // Error if extra arguments are found on the command line
+  if (optind < argc) {
+    cerr << "Error: unknown/extra arguments specified on command line" << endl;
+    ABORT(-1);
+  }
+
+  if (data_dir.length()==0) {
+    cerr << "Error: must specify the recorded data directory. (Try --help)" << endl;
+    ABORT(-1);
+  }
+}
+
+// Main benchmark routine.
+int main(
+  const int argc,
+  char * const argv[]
+) {
+  string data_dir;
+  double freq;
+  uint16 n_reps;
+  parse_commandline(argc,argv,data_dir,freq,n_reps);
+
+  // Pre-plan the FFT's and persist FFTW wisdom across invocations.
+  fft_wisdom_init(data_dir);
+
+  // Nominal sampling rate and frequency offset search set matching what
+  // CellSearch uses with its default 120ppm crystal uncertainty.
+  const double fs_programmed=FS_LTE/16;
+  const uint16 n_extra=floor_i((freq*120/1e6+2.5e3)/5e3);
+  const vec f_search_set=to_vec(itpp_ext::matlab_range(-n_extra*5000,5000,n_extra*5000));
+
+  cout << "LTE searcher benchmark v" << MAJOR_VERSION << "." << MINOR_VERSION << "." << PATCH_LEVEL << " (" << BUILD_TYPE << ")" << endl;
+  cout << "reps per stage: " << n_reps << "; frequency offset hypotheses: " << length(f_search_set) << endl;
+
+  // Recorded input containing a real cell.
+  {
+    stringstream filename;
+    filename << data_dir << "/capbuf_0000.it";
+    it_ifile itf(filename.str());
+    cvec capbuf;
+    itf.seek("capbuf");
+    itf>>capbuf;
+    ivec fc_v;
+    itf.seek("fc");
+    itf>>fc_v;
+    itf.close();
+    if (freq!=fc_v(0)) {
+      cout << "Warning: recorded input was captured at " << fc_v(0)/1e6 << " MHz, not " << freq/1e6 << " MHz" << endl;
+    }
+    benchmark_buffer("recorded",capbuf,freq,fs_programmed,f_search_set,n_reps);
+  }
+
+  // Seeded synthetic noise. Always produces the same buffer so results
+  // are comparable between machines and releases.
+  {
+    RNG_reset(1234);
+    cvec capbuf=sqrt(0.5)*randn_c(CAPLENGTH);
+    benchmark_buffer("synthetic noise",capbuf,freq,fs_programmed,f_search_set,n_reps);
+  }
+
+  return 0;
+}
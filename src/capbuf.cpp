@@ -16,11 +16,20 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <itpp/itbase.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <iomanip>
+#include <fstream>
 #include <sstream>
 #include <queue>
 #include <curses.h>
 #include <boost/math/special_functions/gamma.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition.hpp>
 #include "rtl-sdr.h"
 #include "common.h"
 #include "capbuf.h"
@@ -35,7 +44,10 @@ using namespace std;
 #define CAPLENGTH 153600
 
 typedef struct {
+  // Preallocated to CAPLENGTH*2 bytes by the caller.
   vector <unsigned char> * buf;
+  // Number of bytes written so far.
+  uint32 n_filled;
   rtlsdr_dev_t * dev;
 } callback_package_t;
 static void capbuf_rtlsdr_callback(
@@ -43,12 +55,9 @@ static void capbuf_rtlsdr_callback(
   uint32_t len,
   void * ctx
 ) {
-  //vector <char> & capbuf_raw = *((vector <char> *)ctx);
-  //callback_package_t * cp=(callback_package_t *)ctx;
   callback_package_t * cp_p=(callback_package_t *)ctx;
   callback_package_t & cp=*cp_p;
-  vector <unsigned char> * capbuf_raw_p=cp.buf;
-  vector <unsigned char> & capbuf_raw=*capbuf_raw_p;
+  vector <unsigned char> & capbuf_raw=*cp.buf;
   rtlsdr_dev_t * dev=cp.dev;
 
   if (len==0) {
@@ -56,23 +65,197 @@ static void capbuf_rtlsdr_callback(
     ABORT(-1);
   }
 
-  for (uint32 t=0;t<len;t++) {
-    //cout << capbuf_raw.size() << endl;
-    if (capbuf_raw.size()<CAPLENGTH*2) {
-      capbuf_raw.push_back(buf[t]);
-    }
-    if (capbuf_raw.size()==CAPLENGTH*2) {
-      //cout << rtlsdr_cancel_async(dev) << endl;
-      rtlsdr_cancel_async(dev);
-      break;
-    }
+  // Copy the whole USB transfer block into the preallocated buffer in
+  // one shot instead of appending byte by byte.
+  const uint32 n_copy=MIN(len,CAPLENGTH*2-cp.n_filled);
+  memcpy(&capbuf_raw[cp.n_filled],buf,n_copy);
+  cp.n_filled+=n_copy;
+  if (cp.n_filled==CAPLENGTH*2) {
+    rtlsdr_cancel_async(dev);
   }
-  //cout << capbuf_raw.size() << endl;
 }
 
 // Declared in from_osmocom.cpp
 double compute_fc_programmed(const double & fosc,const double & intended_flo);
 
+// Tune the dongle and calculate the center frequency that was actually
+// programmed.
+static void tune_dongle(
+  rtlsdr_dev_t * dev,
+  const double & fc_requested,
+  const double & correction,
+  double & fc_programmed
+) {
+  // Center frequency
+  uint8 n_fail=0;
+  while (rtlsdr_set_center_freq(dev,itpp::round(fc_requested*correction))<0) {
+    n_fail++;
+    if (n_fail>=5) {
+      cerr << "Error: unable to set center frequency" << endl;
+      ABORT(-1);
+    }
+    cerr << "Unable to set center frequency... retrying..." << endl;
+    sleep(1);
+  }
+
+  // Calculate the actual center frequency that was programmed.
+  if (rtlsdr_get_tuner_type(dev)==RTLSDR_TUNER_E4000) {
+    // This does not return the true center frequency, only the requested
+    // center frequency.
+    //fc_programmed=(double)rtlsdr_get_center_freq(dev);
+    // Directly call some rtlsdr frequency calculation routines.
+    fc_programmed=compute_fc_programmed(28.8e6,fc_requested);
+    // For some reason, this will tame the slow time offset drift.
+    // I don't know if this is a problem caused by the hardware or a problem
+    // with the tracking algorithm.
+    fc_programmed=fc_programmed+58;
+    //MARK;
+    //fc_programmed=fc_requested;
+  } else {
+    // Unsupported tuner...
+    fc_programmed=fc_requested;
+  }
+}
+
+// Table mapping a raw IQ byte straight to its scaled value.
+struct byte_lut_t {
+  byte_lut_t(void) {
+    for (uint16 t=0;t<256;t++) {
+      lut[t]=(t-127.0)/128.0;
+    }
+  }
+  double lut[256];
+};
+static const double * byte_lut(void) {
+  // Function-local static: C++11 guarantees the constructor runs
+  // exactly once even when captures convert concurrently.
+  static const byte_lut_t table;
+  return table.lut;
+}
+
+// Header at the start of each raw capture file. The payload follows
+// immediately as interleaved offset-binary IQ bytes (the dongle's
+// native format), so replaying a raw file costs only the same uint8 to
+// double conversion as the live capture path.
+#define CAPBUF_RAW_MAGIC 0x57524342
+#define CAPBUF_RAW_VERSION 1
+typedef struct {
+  uint32 magic;
+  uint32 version;
+  double fc_requested;
+  double fc_programmed;
+  // Nominal sampling rate, in Hz.
+  double fs;
+  // Seconds since the epoch when the capture was taken.
+  int64 timestamp;
+  // Number of complex samples. The payload is twice this many bytes.
+  uint32 n_samples;
+} capbuf_raw_header_t;
+
+// Append one line describing a freshly saved raw capture to the index
+// file in the same directory. A directory full of captures can then be
+// inventoried by reading the index instead of opening every file.
+static void capbuf_raw_index_append(
+  const string & data_dir,
+  const string & filename,
+  const capbuf_raw_header_t & header
+) {
+  stringstream index_name;
+  index_name << data_dir << "/capbuf_index.txt";
+  ofstream index(index_name.str().c_str(),ios::app);
+  if (!index) {
+    cerr << "Error: unable to update raw capture index file" << endl;
+    ABORT(-1);
+  }
+  index << filename << " " << setprecision(20) << header.fc_requested << " " << header.fs << " " << header.n_samples << " " << header.timestamp << endl;
+}
+
+// Save a raw capture file and add it to the index.
+static void capbuf_raw_save(
+  const string & data_dir,
+  const string & filename,
+  const double & fc_requested,
+  const double & fc_programmed,
+  const double & fs,
+  const vector <unsigned char> & capbuf_raw
+) {
+  capbuf_raw_header_t header;
+  memset(&header,0,sizeof(header));
+  header.magic=CAPBUF_RAW_MAGIC;
+  header.version=CAPBUF_RAW_VERSION;
+  header.fc_requested=fc_requested;
+  header.fc_programmed=fc_programmed;
+  header.fs=fs;
+  header.timestamp=time(NULL);
+  header.n_samples=capbuf_raw.size()/2;
+
+  ofstream file(filename.c_str(),ios::binary);
+  if (!file) {
+    cerr << "Error: unable to write raw capture file: " << filename << endl;
+    ABORT(-1);
+  }
+  file.write((const char *)&header,sizeof(header));
+  file.write((const char *)&capbuf_raw[0],capbuf_raw.size());
+  file.close();
+
+  capbuf_raw_index_append(data_dir,filename,header);
+}
+
+// Memory map a raw capture file and convert the payload directly into
+// the capture buffer. Unlike the it_ifile path there is no per-element
+// deserialization; the kernel pages the IQ bytes in as they are read.
+static void capbuf_raw_load(
+  const string & filename,
+  const double & fc_requested,
+  cvec & capbuf,
+  double & fc_programmed
+) {
+  int fd=open(filename.c_str(),O_RDONLY);
+  if (fd==-1) {
+    cerr << "Error: unable to open raw capture file: " << filename << endl;
+    ABORT(-1);
+  }
+  struct stat st;
+  if (fstat(fd,&st)==-1) {
+    cerr << "Error: unable to stat raw capture file: " << filename << endl;
+    ABORT(-1);
+  }
+  const size_t file_size=st.st_size;
+  if (file_size<sizeof(capbuf_raw_header_t)) {
+    cerr << "Error: truncated raw capture file: " << filename << endl;
+    ABORT(-1);
+  }
+  void * map=mmap(NULL,file_size,PROT_READ,MAP_PRIVATE,fd,0);
+  if (map==MAP_FAILED) {
+    cerr << "Error: unable to mmap raw capture file: " << filename << endl;
+    ABORT(-1);
+  }
+  const capbuf_raw_header_t & header=*((const capbuf_raw_header_t *)map);
+  if ((header.magic!=CAPBUF_RAW_MAGIC)||(header.version!=CAPBUF_RAW_VERSION)) {
+    cerr << "Error: unrecognized raw capture file format: " << filename << endl;
+    ABORT(-1);
+  }
+  if (file_size<sizeof(capbuf_raw_header_t)+2*(size_t)header.n_samples) {
+    cerr << "Error: truncated raw capture file: " << filename << endl;
+    ABORT(-1);
+  }
+  if (fc_requested!=header.fc_requested) {
+    cout << "Warning: while reading capture buffer " << filename << ", the read" << endl;
+    cout << "center frequency did not match the expected center frequency." << endl;
+  }
+  fc_programmed=header.fc_programmed;
+
+  const unsigned char * raw=((const unsigned char *)map)+sizeof(capbuf_raw_header_t);
+  const double * lut=byte_lut();
+  capbuf.set_size(header.n_samples);
+  for (uint32 t=0;t<header.n_samples;t++) {
+    capbuf(t)=complex<double>(lut[raw[(t<<1)]],lut[raw[(t<<1)+1]]);
+  }
+
+  munmap(map,file_size);
+  close(fd);
+}
+
 // This function produces a vector of captured data. The data can either
 // come from live data received by the RTLSDR, or from a file containing
 // previously captured data.
@@ -84,6 +267,7 @@ void capture_data(
   const double & correction,
   const bool & save_cap,
   const bool & use_recorded_data,
+  const bool & use_raw_format,
   const string & data_dir,
   rtlsdr_dev_t * & dev,
   // Output
@@ -93,7 +277,11 @@ void capture_data(
   // Filename used for recording or loading captured data.
   static uint32 capture_number=0;
   stringstream filename;
-  filename << data_dir << "/capbuf_" << setw(4) << setfill('0') << capture_number << ".it";
+  filename << data_dir << "/capbuf_" << setw(4) << setfill('0') << capture_number << (use_raw_format?".raw":".it");
+
+  // Raw bytes of the most recent live capture. Kept outside the branch
+  // below because the raw file format saves these bytes directly.
+  vector <unsigned char> capbuf_raw;
 
   if (use_recorded_data) {
     // Read data from a file. Do not use live data.
@@ -101,52 +289,28 @@ void capture_data(
       cout << "Reading captured data from file: " << filename.str() << endl;
     }
 
-    it_ifile itf(filename.str());
-    itf.seek("capbuf");
-    itf>>capbuf;
-    itf.seek("fc");
-    ivec fc_v;
-    itf>>fc_v;
-    if (fc_requested!=fc_v(0)) {
-      cout << "Warning: while reading capture buffer " << capture_number << ", the read" << endl;
-      cout << "center frequency did not match the expected center frequency." << endl;
+    if (use_raw_format) {
+      capbuf_raw_load(filename.str(),fc_requested,capbuf,fc_programmed);
+    } else {
+      it_ifile itf(filename.str());
+      itf.seek("capbuf");
+      itf>>capbuf;
+      itf.seek("fc");
+      ivec fc_v;
+      itf>>fc_v;
+      if (fc_requested!=fc_v(0)) {
+        cout << "Warning: while reading capture buffer " << capture_number << ", the read" << endl;
+        cout << "center frequency did not match the expected center frequency." << endl;
+      }
+      itf.close();
     }
-    itf.close();
 
   } else {
     if (verbosity>=2) {
       cout << "Capturing live data" << endl;
     }
 
-    // Center frequency
-    uint8 n_fail=0;
-    while (rtlsdr_set_center_freq(dev,itpp::round(fc_requested*correction))<0) {
-      n_fail++;
-      if (n_fail>=5) {
-        cerr << "Error: unable to set center frequency" << endl;
-        ABORT(-1);
-      }
-      cerr << "Unable to set center frequency... retrying..." << endl;
-      sleep(1);
-    }
-
-    // Calculate the actual center frequency that was programmed.
-    if (rtlsdr_get_tuner_type(dev)==RTLSDR_TUNER_E4000) {
-      // This does not return the true center frequency, only the requested
-      // center frequency.
-      //fc_programmed=(double)rtlsdr_get_center_freq(dev);
-      // Directly call some rtlsdr frequency calculation routines.
-      fc_programmed=compute_fc_programmed(28.8e6,fc_requested);
-      // For some reason, this will tame the slow time offset drift.
-      // I don't know if this is a problem caused by the hardware or a problem
-      // with the tracking algorithm.
-      fc_programmed=fc_programmed+58;
-      //MARK;
-      //fc_programmed=fc_requested;
-    } else {
-      // Unsupported tuner...
-      fc_programmed=fc_requested;
-    }
+    tune_dongle(dev,fc_requested,correction,fc_programmed);
 
     // Reset the buffer
     if (rtlsdr_reset_buffer(dev)<0) {
@@ -156,28 +320,29 @@ void capture_data(
 
     // Read and store the data.
     // This will block until the call to rtlsdr_cancel_async().
-    vector <unsigned char> capbuf_raw;
-    capbuf_raw.reserve(CAPLENGTH*2);
+    // The buffer is sized in advance so the callback can memcpy whole
+    // USB transfer blocks directly into it.
+    capbuf_raw.resize(CAPLENGTH*2);
     callback_package_t cp;
     cp.buf=&capbuf_raw;
+    cp.n_filled=0;
     cp.dev=dev;
 
     rtlsdr_read_async(dev,capbuf_rtlsdr_callback,(void *)&cp,0,0);
 
-    // Convert to complex
+    // Convert to complex in one pass. A 256 entry table maps each raw
+    // byte straight to its scaled value, avoiding the per-sample
+    // subtract and divide.
+    const double * lut=byte_lut();
     capbuf.set_size(CAPLENGTH);
 #ifndef NDEBUG
     capbuf=NAN;
 #endif
+    const unsigned char * raw=&capbuf_raw[0];
     for (uint32 t=0;t<CAPLENGTH;t++) {
-      // Normal
-      capbuf(t)=complex<double>((((double)capbuf_raw[(t<<1)])-127.0)/128.0,(((double)capbuf_raw[(t<<1)+1])-127.0)/128.0);
-      // Conjugate
-      //capbuf(t)=complex<double>((capbuf_raw[(t<<1)]-127.0)/128.0,-(capbuf_raw[(t<<1)+1]-127.0)/128.0);
-      // Swap I/Q
-      //capbuf(t)=complex<double>((capbuf_raw[(t<<1)+1]-127.0)/128.0,(capbuf_raw[(t<<1)]-127.0)/128.0);
-      // Swap I/Q and conjugate
-      //capbuf(t)=complex<double>((capbuf_raw[(t<<1)+1]-127.0)/128.0,-(capbuf_raw[(t<<1)]-127.0)/128.0);
+      // Normal. (Conjugate and/or swapped I/Q, used during bringup, can
+      // be obtained by swapping or negating the table lookups.)
+      capbuf(t)=complex<double>(lut[raw[(t<<1)]],lut[raw[(t<<1)+1]]);
     }
     //cout << "capbuf power: " << db10(sigpower(capbuf)) << " dB" << endl;
 
@@ -188,14 +353,158 @@ void capture_data(
     if (verbosity>=2) {
       cout << "Saving captured data to file: " << filename.str() << endl;
     }
-    it_file itf(filename.str(),true);
-    itf << Name("capbuf") << capbuf;
-    ivec fc_v(1);
-    fc_v(0)=fc_requested;
-    itf << Name("fc") << fc_v;
-    itf.close();
+    if (use_raw_format) {
+      capbuf_raw_save(data_dir,filename.str(),fc_requested,fc_programmed,1920000*correction,capbuf_raw);
+    } else {
+      it_file itf(filename.str(),true);
+      itf << Name("capbuf") << capbuf;
+      ivec fc_v(1);
+      fc_v(0)=fc_requested;
+      itf << Name("fc") << fc_v;
+      itf.close();
+    }
   }
 
   capture_number++;
 }
 
+// Ring size in bytes: four capture windows (about 320ms) of slack
+// between the background reader and the consumer.
+#define RING_LENGTH (4*CAPLENGTH*2)
+// Bytes discarded after a retune. USB transfers already in flight when
+// the tune completes may still hold samples captured at the old center
+// frequency; two default sized transfers cover them.
+#define RING_TUNE_DISCARD (2*16*32*512*2)
+
+static void capture_ring_callback(
+  unsigned char * buf,
+  uint32_t len,
+  void * ctx
+) {
+  capture_ring_t & ring=*((capture_ring_t *)ctx);
+
+  if (len==0) {
+    cerr << "Error: received no samples from USB device..." << endl;
+    ABORT(-1);
+  }
+
+  boost::mutex::scoped_lock lock(ring.mutex);
+  if (ring.stop) {
+    rtlsdr_cancel_async(ring.dev);
+    return;
+  }
+  // Copy into the ring, wrapping as necessary. Old samples are simply
+  // overwritten; the consumer skips forward if it falls behind.
+  uint32 n_copied=0;
+  while (n_copied<len) {
+    const uint32 pos=ring.n_written%RING_LENGTH;
+    const uint32 n_copy=MIN(len-n_copied,RING_LENGTH-pos);
+    memcpy(&ring.buf[pos],buf+n_copied,n_copy);
+    n_copied+=n_copy;
+    ring.n_written+=n_copy;
+  }
+  ring.condition.notify_one();
+}
+
+static void capture_ring_reader(
+  capture_ring_t * ring_p
+) {
+  // Blocks until capture_ring_stop() cancels the stream.
+  rtlsdr_read_async(ring_p->dev,capture_ring_callback,(void *)ring_p,0,0);
+}
+
+// Serve one capture window out of the continuous stream. The first call
+// (and every call after a center frequency change) tunes the dongle and
+// discards the samples captured at the old frequency; subsequent calls
+// at the same frequency return a fresh, non-overlapping window with no
+// USB round trip or settling delay at all.
+void capture_data_continuous(
+  // Inputs
+  const double & fc_requested,
+  const double & correction,
+  rtlsdr_dev_t * & dev,
+  capture_ring_t & ring,
+  // Output
+  cvec & capbuf,
+  double & fc_programmed
+) {
+  // Start the background reader on first use. The stream then runs
+  // until capture_ring_stop(); retuning does not interrupt it.
+  if (!ring.running) {
+    ring.dev=dev;
+    ring.buf.resize(RING_LENGTH);
+    ring.n_written=0;
+    ring.n_consumed=0;
+    ring.stop=false;
+    if (rtlsdr_reset_buffer(dev)<0) {
+      cerr << "Error: unable to reset RTLSDR buffer" << endl;
+      ABORT(-1);
+    }
+    ring.reader=new boost::thread(capture_ring_reader,&ring);
+    ring.running=true;
+  }
+
+  // Retune without stopping the stream and discard everything captured
+  // at (or straddling) the old center frequency.
+  if (fc_requested!=ring.fc_requested) {
+    tune_dongle(dev,fc_requested,correction,ring.fc_programmed);
+    ring.fc_requested=fc_requested;
+    boost::mutex::scoped_lock lock(ring.mutex);
+    ring.n_consumed=ring.n_written+RING_TUNE_DISCARD;
+  }
+  fc_programmed=ring.fc_programmed;
+
+  if (verbosity>=2) {
+    cout << "Serving capture window from the continuous stream" << endl;
+  }
+
+  // Wait for a full window beyond the last one handed out and copy the
+  // raw bytes while holding the lock; the uint8 to double conversion
+  // happens outside so as not to stall the USB callback.
+  vector <unsigned char> window(CAPLENGTH*2);
+  {
+    boost::mutex::scoped_lock lock(ring.mutex);
+    while (ring.n_written<ring.n_consumed+CAPLENGTH*2) {
+      ring.condition.wait(lock);
+    }
+    uint64 start=ring.n_consumed;
+    if (ring.n_written>start+RING_LENGTH) {
+      // The consumer fell behind and the ring has wrapped past the
+      // next unread byte; take the most recent full window instead.
+      start=ring.n_written-CAPLENGTH*2;
+    }
+    for (uint32 t=0;t<CAPLENGTH*2;) {
+      const uint32 pos=(start+t)%RING_LENGTH;
+      const uint32 n_copy=MIN(CAPLENGTH*2-t,RING_LENGTH-pos);
+      memcpy(&window[t],&ring.buf[pos],n_copy);
+      t+=n_copy;
+    }
+    ring.n_consumed=start+CAPLENGTH*2;
+  }
+
+  // Convert to complex in one pass.
+  const double * lut=byte_lut();
+  capbuf.set_size(CAPLENGTH);
+  const unsigned char * raw=&window[0];
+  for (uint32 t=0;t<CAPLENGTH;t++) {
+    capbuf(t)=complex<double>(lut[raw[(t<<1)]],lut[raw[(t<<1)+1]]);
+  }
+}
+
+// Stop the background reader and release the stream.
+void capture_ring_stop(
+  capture_ring_t & ring
+) {
+  if (!ring.running)
+    return;
+  {
+    boost::mutex::scoped_lock lock(ring.mutex);
+    ring.stop=true;
+  }
+  rtlsdr_cancel_async(ring.dev);
+  ring.reader->join();
+  delete ring.reader;
+  ring.reader=NULL;
+  ring.running=false;
+}
+
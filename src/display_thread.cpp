@@ -26,6 +26,8 @@
 #include <boost/thread/condition.hpp>
 #include <list>
 #include <sstream>
+#include <fstream>
+#include <time.h>
 #include <signal.h>
 #include <queue>
 #include <curses.h>
@@ -112,6 +114,11 @@ void display_cell(
   const bool & avg_values,
   const bool & expert_mode
 ) {
+  // Take a consistent snapshot of the measurements. This never blocks
+  // the tracker workers.
+  cell_meas_t meas;
+  tracked_cell.read_meas(meas);
+
   move(row,0);
   attron(COLOR_PAIR(BLUE));
   printw("[Cell ID %3i][TO: %7.1lf]",
@@ -119,9 +126,9 @@ void display_cell(
     tracked_cell.frame_timing()
   );
   if (expert_mode) {
-    printw("[UOS pwr: %5.1lf dB]",db10(tracked_cell.sync_np_blank_av));
+    printw("[UOS pwr: %5.1lf dB]",db10(meas.sync_np_blank_av));
   }
-  const double health=100-tracked_cell.mib_decode_failures/CELL_DROP_THRESHOLD*100;
+  const double health=100-meas.mib_decode_failures/CELL_DROP_THRESHOLD*100;
   attroff(COLOR_PAIR(BLUE));
   uint32 attrs=0;
   if (health<25) {
@@ -138,9 +145,16 @@ void display_cell(
   attroff(attrs);
   attron(COLOR_PAIR(BLUE));
   if (fifo_status) {
+    uint32 fifo_size;
+    uint32 fifo_peak_size;
+    {
+      boost::mutex::scoped_lock lock(tracked_cell.fifo_mutex);
+      fifo_size=tracked_cell.fifo.size();
+      fifo_peak_size=tracked_cell.fifo_peak_size;
+    }
     printw("[buffer %5i/%5i]",
-      tracked_cell.fifo.size(),
-      tracked_cell.fifo_peak_size
+      fifo_size,
+      fifo_peak_size
     );
   }
   printw("\n");
@@ -152,20 +166,20 @@ void display_cell(
     if (expert_mode) {
       if (avg_values) {
         printw("%5.1lf/%5.1lf/%5.1lf",
-          db10(tracked_cell.crs_sp_raw_av(t)),
-          db10(tracked_cell.crs_np_av(t)),
-          db10(tracked_cell.crs_sp_raw_av(t)/tracked_cell.crs_np_av(t))
+          db10(meas.crs_sp_raw_av(t)),
+          db10(meas.crs_np_av(t)),
+          db10(meas.crs_sp_raw_av(t)/meas.crs_np_av(t))
         );
       } else {
         printw("%5.1lf/%5.1lf/%5.1lf",
-          db10(tracked_cell.crs_sp_raw(t)),
-          db10(tracked_cell.crs_np(t)),
-          db10(tracked_cell.crs_sp_raw(t)/tracked_cell.crs_np(t))
+          db10(meas.crs_sp_raw(t)),
+          db10(meas.crs_np(t)),
+          db10(meas.crs_sp_raw(t)/meas.crs_np(t))
         );
       }
       int8 CB=-1;
       for (uint8 k=1;k<12;k++) {
-        if (abs(tracked_cell.ac_fd(k))<=0.5) {
+        if (abs(meas.ac_fd(k))<=0.5) {
           CB=k;
           break;
         }
@@ -176,9 +190,9 @@ void display_cell(
         printw(" %4i kHz\n",CB*90);
       }
     } else {
-      if (isfinite(db10(tracked_cell.crs_sp_raw_av(t)/tracked_cell.crs_np_av(t)))) {
+      if (isfinite(db10(meas.crs_sp_raw_av(t)/meas.crs_np_av(t)))) {
         printw("%5.1lf dB SNR\n",
-          db10(tracked_cell.crs_sp_raw_av(t)/tracked_cell.crs_np_av(t))
+          db10(meas.crs_sp_raw_av(t)/meas.crs_np_av(t))
         );
       } else {
         printw(" -Inf dB SNR\n");
@@ -188,21 +202,21 @@ void display_cell(
   if (expert_mode) {
     if (avg_values) {
       printw("  S  %5.1lf/%5.1lf/%5.1lf\n",
-        db10(tracked_cell.sync_sp_av),
-        db10(tracked_cell.sync_np_av),
-        db10(tracked_cell.sync_sp_av/tracked_cell.sync_np_av)
+        db10(meas.sync_sp_av),
+        db10(meas.sync_np_av),
+        db10(meas.sync_sp_av/meas.sync_np_av)
       );
     } else {
       printw("  S  %5.1lf/%5.1lf/%5.1lf\n",
-        db10(tracked_cell.sync_sp),
-        db10(tracked_cell.sync_np),
-        db10(tracked_cell.sync_sp/tracked_cell.sync_np)
+        db10(meas.sync_sp),
+        db10(meas.sync_np),
+        db10(meas.sync_sp/meas.sync_np)
       );
     }
   } else {
-    if (isfinite(db10(tracked_cell.sync_sp_av/tracked_cell.sync_np_av))) {
+    if (isfinite(db10(meas.sync_sp_av/meas.sync_np_av))) {
       printw("  S  %5.1lf dB SNR\n",
-        db10(tracked_cell.sync_sp_av/tracked_cell.sync_np_av)
+        db10(meas.sync_sp_av/meas.sync_np_av)
       );
     } else {
       printw("  S   -Inf dB SNR\n");
@@ -369,13 +383,42 @@ void plot_trace(
 
 }
 
+// Append one machine-readable stats line to the export file. Called
+// about once per second; together with the lock-free counters this
+// gives enough history to tell which stage fell behind when data
+// starts being dropped.
+static void export_stats(
+  const string & stats_filename,
+  sampbuf_sync_t & sampbuf_sync,
+  global_thread_data_t & global_thread_data
+) {
+  ofstream stats(stats_filename.c_str(),ios::app);
+  if (!stats) {
+    // Not worth killing the program over; the display still works.
+    return;
+  }
+  stats << time(NULL);
+  stats << " raw_fifo=" << sampbuf_sync.fifo.size();
+  stats << " raw_fifo_peak=" << sampbuf_sync.fifo.peak_size();
+  stats << " raw_dropped=" << global_thread_data.raw_seconds_dropped();
+  stats << " cell_dropped=" << global_thread_data.cell_seconds_dropped();
+  stats << " search_cycles=" << global_thread_data.searcher_cycle_hist.count();
+  stats << " search_mean_us=" << (uint64)global_thread_data.searcher_cycle_hist.mean_us();
+  stats << " search_p90_us=" << (uint64)global_thread_data.searcher_cycle_hist.quantile_us(0.9);
+  stats << " symbols=" << global_thread_data.tracker_symbols_processed.load(std::memory_order_relaxed);
+  stats << " symbol_mean_us=" << (uint64)global_thread_data.tracker_symbol_hist.mean_us();
+  stats << " symbol_p99_us=" << (uint64)global_thread_data.tracker_symbol_hist.quantile_us(0.99);
+  stats << endl;
+}
+
 // Process that displays the status of all the tracker threads.
 enum disp_mode_t {STD, DETAIL};
 void display_thread(
   sampbuf_sync_t & sampbuf_sync,
   global_thread_data_t & global_thread_data,
   tracked_cell_list_t & tracked_cell_list,
-  bool & expert_mode
+  bool & expert_mode,
+  string & stats_filename
 ) {
   global_thread_data.display_thread_id=syscall(SYS_gettid);
 
@@ -436,7 +479,14 @@ void display_thread(
   //cbreak();
   halfdelay(round_i(refresh_delay_sec*10.0));
   int16 highlight_row=-1;
+  time_t last_stats_export=0;
   while (true) {
+    // Export the performance counters about once per second.
+    if ((stats_filename.length()!=0)&&(time(NULL)!=last_stats_export)) {
+      last_stats_export=time(NULL);
+      export_stats(stats_filename,sampbuf_sync,global_thread_data);
+    }
+
     clear();
     //attron(COLOR_PAIR(3));
 
@@ -457,10 +507,6 @@ void display_thread(
       while (it!=tracked_cell_list.tracked_cells.end()) {
         tracked_cell_t & tracked_cell=(*(*it));
 
-        // Deadlock possible???
-        boost::mutex::scoped_lock lock1(tracked_cell.fifo_mutex);
-        boost::mutex::scoped_lock lock2(tracked_cell.meas_mutex);
-
         uint8 n_rows_required=tracked_cell.n_ports+2;
 
         // If this cell has been displayed before, try to display it
@@ -485,10 +531,6 @@ void display_thread(
       for (uint8 t=0;t<pass2_display.size();t++) {
         tracked_cell_t & tracked_cell=(*pass2_display[t]);
 
-        // Deadlock possible???
-        boost::mutex::scoped_lock lock1(tracked_cell.fifo_mutex);
-        boost::mutex::scoped_lock lock2(tracked_cell.meas_mutex);
-
         uint8 n_rows_required=tracked_cell.n_ports+2;
         bool placed=false;
         for (uint16 k=0;k<CELL_DISP_N_ROWS-n_rows_required+1;k++) {
@@ -556,12 +598,17 @@ void display_thread(
       //attron(A_BOLD);
       printw("[searcher delay: %.1lf s]",global_thread_data.searcher_cycle_time());
       //attroff(A_BOLD);
+      if (expert_mode) {
+        printw("[sym proc mean/p99: %.0lf/%.0lf us]",
+          global_thread_data.tracker_symbol_hist.mean_us(),
+          global_thread_data.tracker_symbol_hist.quantile_us(0.99)
+        );
+      }
 
       if (fifo_status) {
-        boost::mutex::scoped_lock lock(sampbuf_sync.mutex);
         stringstream ss;
-        uint8 w=ceil(log10(sampbuf_sync.fifo_peak_size));
-        ss << "[inp buf: " << setw(w) << sampbuf_sync.fifo.size() << "/" << sampbuf_sync.fifo_peak_size << "]";
+        uint8 w=ceil(log10(sampbuf_sync.fifo.peak_size()));
+        ss << "[inp buf: " << setw(w) << sampbuf_sync.fifo.size() << "/" << sampbuf_sync.fifo.peak_size() << "]";
         //attron(A_BOLD);
         printw("%s\n",ss.str().c_str());
         //attroff(A_BOLD);
@@ -616,14 +663,16 @@ void display_thread(
         }
         if (cell_found) {
           tracked_cell_t & tracked_cell=(*(*it));
-          boost::mutex::scoped_lock lock2(tracked_cell.meas_mutex);
+          // Snapshot the measurements; no locking against the trackers.
+          cell_meas_t meas;
+          tracked_cell.read_meas(meas);
           if (detail_type==0) {
             // Plot transfer function mag
             vec trace;
             if (port_num==-1) {
-              trace=db10(sqr(tracked_cell.sync_ce));
+              trace=db10(sqr(meas.sync_ce));
             } else {
-              trace=db10(sqr(tracked_cell.ce.get_row(port_num)));
+              trace=db10(sqr(meas.ce.get_row(port_num)));
             }
             plot_trace(
               // Trace desc.
@@ -660,9 +709,9 @@ void display_thread(
             vec trace;
             double mean_ang;
             if (port_num==-1) {
-              trace=arg(tracked_cell.sync_ce);
+              trace=arg(meas.sync_ce);
               mean_ang=arg(sum(exp(J*trace(5,66))));
-              trace=arg(tracked_cell.sync_ce*exp(J*-mean_ang));
+              trace=arg(meas.sync_ce*exp(J*-mean_ang));
               trace(0)=NAN;
               trace(1)=NAN;
               trace(2)=NAN;
@@ -674,9 +723,9 @@ void display_thread(
               trace(70)=NAN;
               trace(71)=NAN;
             } else {
-              trace=arg(tracked_cell.ce.get_row(port_num));
+              trace=arg(meas.ce.get_row(port_num));
               mean_ang=arg(sum(exp(J*trace)));
-              trace=arg(tracked_cell.ce.get_row(port_num)*exp(J*-mean_ang));
+              trace=arg(meas.ce.get_row(port_num)*exp(J*-mean_ang));
             }
             trace=trace/pi*180;
             plot_trace(
@@ -711,7 +760,7 @@ void display_thread(
             attroff(COLOR_PAIR(GREEN));
           } else if (detail_type==2) {
             // Frequency domain autocorrelation
-            const vec trace=abs(tracked_cell.ac_fd);
+            const vec trace=abs(meas.ac_fd);
             plot_trace(
               // Trace desc.
               trace,itpp_ext::matlab_range(0.0,11.0),
@@ -730,7 +779,7 @@ void display_thread(
             printw("Frequency domain channel autocorrelation function. x-axis spans 1.26MHz\n");
           } else if (detail_type==3) {
             // Time domain autocorrelation
-            const vec trace=abs(tracked_cell.ac_td);
+            const vec trace=abs(meas.ac_td);
             plot_trace(
               // Trace desc.
               trace,itpp_ext::matlab_range(0.0,71.0)*.0005,
@@ -19,7 +19,10 @@
 #include <itpp/signal/transforms.h>
 #include <complex>
 #include <cmath>
+#include <map>
+#include <fftw3.h>
 #include <boost/math/special_functions/gamma.hpp>
+#include <boost/thread/mutex.hpp>
 #include "rtl-sdr.h"
 #include "common.h"
 #include "macros.h"
@@ -46,6 +49,137 @@ cvec fshift(const cvec &seq,const double f) {
 }
 */
 
+// FFTW's planner is not thread safe and must be serialized even though the
+// plans themselves are private to each thread.
+static boost::mutex fftw_planner_mutex;
+
+// One cached transform: the FFTW plan together with the aligned in-place
+// working buffer it was planned against.
+typedef struct {
+  fftw_plan plan;
+  fftw_complex * buf;
+} fft_plan_t;
+
+// Per-thread cache of FFTW plans, keyed on transform length and direction.
+// A plan is created with FFTW_MEASURE the first time a length is seen and
+// reused for every subsequent transform of that length. IT++'s fft()/ifft()
+// only remember the most recently used length and replan whenever the length
+// changes, which is costly when 128 point symbol transforms are interleaved
+// with 1024 point correlator blocks.
+class fft_plan_cache_t {
+  public:
+    ~fft_plan_cache_t();
+    itpp::cvec transform(const itpp::cvec & x,const int sign);
+  private:
+    std::map <std::pair <int,int>,fft_plan_t> plans;
+};
+
+fft_plan_cache_t::~fft_plan_cache_t() {
+  boost::mutex::scoped_lock lock(fftw_planner_mutex);
+  std::map <std::pair <int,int>,fft_plan_t>::iterator it;
+  for (it=plans.begin();it!=plans.end();++it) {
+    fftw_destroy_plan((*it).second.plan);
+    fftw_free((*it).second.buf);
+  }
+}
+
+cvec fft_plan_cache_t::transform(
+  const cvec & x,
+  const int sign
+) {
+  const int n=length(x);
+  const std::pair <int,int> key(n,sign);
+  std::map <std::pair <int,int>,fft_plan_t>::iterator it=plans.find(key);
+  if (it==plans.end()) {
+    fft_plan_t entry;
+    boost::mutex::scoped_lock lock(fftw_planner_mutex);
+    entry.buf=(fftw_complex *)fftw_malloc(sizeof(fftw_complex)*n);
+    entry.plan=fftw_plan_dft_1d(n,entry.buf,entry.buf,sign,FFTW_MEASURE);
+    it=plans.insert(std::make_pair(key,entry)).first;
+  }
+  fft_plan_t & entry=(*it).second;
+
+  for (int t=0;t<n;t++) {
+    entry.buf[t][0]=real(x(t));
+    entry.buf[t][1]=imag(x(t));
+  }
+  fftw_execute(entry.plan);
+  cvec y(n);
+  // Match IT++'s convention of scaling only the inverse transform, by 1/N.
+  const double scale=(sign==FFTW_BACKWARD)?(1.0/n):1.0;
+  for (int t=0;t<n;t++) {
+    y(t)=complex <double>(entry.buf[t][0]*scale,entry.buf[t][1]*scale);
+  }
+  return y;
+}
+
+static thread_local fft_plan_cache_t fft_plans;
+
+// Drop-in replacements for IT++'s fft()/ifft() that reuse cached
+// FFTW_MEASURE plans instead of replanning whenever the length changes.
+cvec fft_cached(const cvec & x) {
+  return fft_plans.transform(x,FFTW_FORWARD);
+}
+cvec ifft_cached(const cvec & x) {
+  return fft_plans.transform(x,FFTW_BACKWARD);
+}
+
+// Load previously saved FFTW wisdom, pre-plan the transform lengths used by
+// the signal processing chain, and write the (possibly extended) wisdom back
+// to disk so that later invocations skip the FFTW_MEASURE planning cost.
+// Threads plan lazily into their own caches, but with the wisdom imported
+// here those plans are created from a table lookup rather than measured from
+// scratch. Call once at startup, before any processing threads are launched.
+void fft_wisdom_init(const string & data_dir) {
+  const string filename=data_dir+"/fftw_wisdom.txt";
+  // Absence of a wisdom file simply means planning takes longer this run.
+  fftw_import_wisdom_from_filename(filename.c_str());
+
+  // 128 point OFDM symbol transforms and the 1024 point overlap-save blocks
+  // of the PSS correlator.
+  const int warm_lengths[]={128,1024};
+  for (uint8 t=0;t<2;t++) {
+    const cvec dummy=zeros_c(warm_lengths[t]);
+    fft_cached(dummy);
+    ifft_cached(dummy);
+  }
+
+  if (!fftw_export_wisdom_to_filename(filename.c_str())) {
+    cout << "Warning: unable to save FFTW wisdom to " << filename << endl;
+  }
+}
+
+// Lazily construct the coefficient bank used by tshift() for fractional
+// shifts. Branch p is a TSHIFT_N_TAPS tap Hamming windowed sinc filter
+// delaying its input by p/TSHIFT_N_PHASES of a sample, normalized to unity
+// DC gain. Tap k of branch p multiplies input sample t+(TSHIFT_N_TAPS/2-1)-k
+// when producing output sample t.
+struct tshift_bank_t {
+  tshift_bank_t(void) {
+    for (uint32 p=0;p<TSHIFT_N_PHASES;p++) {
+      const double d=((double)p)/TSHIFT_N_PHASES;
+      double h_sum=0;
+      for (uint32 k=0;k<TSHIFT_N_TAPS;k++) {
+        const double x=((double)k)-(TSHIFT_N_TAPS/2-1)-d;
+        const double sinc=(x==0)?1.0:(sin(pi*x)/(pi*x));
+        const double wind=0.54-0.46*cos((2*pi*k)/(TSHIFT_N_TAPS-1.0));
+        coef[p*TSHIFT_N_TAPS+k]=sinc*wind;
+        h_sum+=sinc*wind;
+      }
+      for (uint32 k=0;k<TSHIFT_N_TAPS;k++) {
+        coef[p*TSHIFT_N_TAPS+k]/=h_sum;
+      }
+    }
+  }
+  double coef[TSHIFT_N_PHASES*TSHIFT_N_TAPS];
+};
+const double * tshift_filter_bank(void) {
+  // Function-local static: C++11 guarantees the constructor runs
+  // exactly once even with concurrent first callers.
+  static const tshift_bank_t bank;
+  return bank.coef;
+}
+
 // Perform FFT based interpolation. Assuming input signal is cyclically
 // repeating signal sampled at M points, return a cyclically repeating
 // signal that is sampled at N points.
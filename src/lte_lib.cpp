@@ -35,112 +35,37 @@ using namespace itpp;
 using namespace std;
 
 // Implementation of the LTE PN generator.
-// A faster implementation is possible using uint32 to store the state.
-// This function was coded using vectors and matrices so as to match
-// the Matlab implementation as directly as possible.
+// Each state machine is stored in a uint32 where bit k holds x(n+k), so
+// advancing by one clock is just a shift and a few xors. This includes
+// the initial advance of 1600 clocks, which used to be performed with
+// two 31x31 binary matrix multiplications; generating the sequence bit
+// by bit is faster than even a single one of those products. This
+// generator sits on the startup path (all of the per-cell RS tables are
+// derived from it) as well as in every MIB decode attempt.
 bvec lte_pn(
   const uint32 & c_init,
   const uint32 & len
 ) {
   // Initialize the state machines
-  bvec x1(31);
-  bvec x2(31);
-  uint32 c_init_temp(c_init);
-  for (uint8 t=0;t<31;t++) {
-    x1(t)=0;
-    x2(t)=(c_init_temp&1);
-    c_init_temp=c_init_temp>>1;
-  }
-  x1(0)=1;
-
-  // These matrices advance the state machines forward by 1600 steps.
-  const static bin x1_p1600_cmat[] = {
-    0,1,0,1,1,1,1,0,0,1,0,0,1,0,0,0,0,1,0,1,1,0,0,0,0,1,0,0,0,0,0,
-    0,0,1,0,1,1,1,1,0,0,1,0,0,1,0,0,0,0,1,0,1,1,0,0,0,0,1,0,0,0,0,
-    0,0,0,1,0,1,1,1,1,0,0,1,0,0,1,0,0,0,0,1,0,1,1,0,0,0,0,1,0,0,0,
-    0,0,0,0,1,0,1,1,1,1,0,0,1,0,0,1,0,0,0,0,1,0,1,1,0,0,0,0,1,0,0,
-    0,0,0,0,0,1,0,1,1,1,1,0,0,1,0,0,1,0,0,0,0,1,0,1,1,0,0,0,0,1,0,
-    0,0,0,0,0,0,1,0,1,1,1,1,0,0,1,0,0,1,0,0,0,0,1,0,1,1,0,0,0,0,1,
-    1,0,0,1,0,0,0,1,0,1,1,1,1,0,0,1,0,0,1,0,0,0,0,1,0,1,1,0,0,0,0,
-    0,1,0,0,1,0,0,0,1,0,1,1,1,1,0,0,1,0,0,1,0,0,0,0,1,0,1,1,0,0,0,
-    0,0,1,0,0,1,0,0,0,1,0,1,1,1,1,0,0,1,0,0,1,0,0,0,0,1,0,1,1,0,0,
-    0,0,0,1,0,0,1,0,0,0,1,0,1,1,1,1,0,0,1,0,0,1,0,0,0,0,1,0,1,1,0,
-    0,0,0,0,1,0,0,1,0,0,0,1,0,1,1,1,1,0,0,1,0,0,1,0,0,0,0,1,0,1,1,
-    1,0,0,1,0,1,0,0,1,0,0,0,1,0,1,1,1,1,0,0,1,0,0,1,0,0,0,0,1,0,1,
-    1,1,0,1,1,0,1,0,0,1,0,0,0,1,0,1,1,1,1,0,0,1,0,0,1,0,0,0,0,1,0,
-    0,1,1,0,1,1,0,1,0,0,1,0,0,0,1,0,1,1,1,1,0,0,1,0,0,1,0,0,0,0,1,
-    1,0,1,0,0,1,1,0,1,0,0,1,0,0,0,1,0,1,1,1,1,0,0,1,0,0,1,0,0,0,0,
-    0,1,0,1,0,0,1,1,0,1,0,0,1,0,0,0,1,0,1,1,1,1,0,0,1,0,0,1,0,0,0,
-    0,0,1,0,1,0,0,1,1,0,1,0,0,1,0,0,0,1,0,1,1,1,1,0,0,1,0,0,1,0,0,
-    0,0,0,1,0,1,0,0,1,1,0,1,0,0,1,0,0,0,1,0,1,1,1,1,0,0,1,0,0,1,0,
-    0,0,0,0,1,0,1,0,0,1,1,0,1,0,0,1,0,0,0,1,0,1,1,1,1,0,0,1,0,0,1,
-    1,0,0,1,0,1,0,1,0,0,1,1,0,1,0,0,1,0,0,0,1,0,1,1,1,1,0,0,1,0,0,
-    0,1,0,0,1,0,1,0,1,0,0,1,1,0,1,0,0,1,0,0,0,1,0,1,1,1,1,0,0,1,0,
-    0,0,1,0,0,1,0,1,0,1,0,0,1,1,0,1,0,0,1,0,0,0,1,0,1,1,1,1,0,0,1,
-    1,0,0,0,0,0,1,0,1,0,1,0,0,1,1,0,1,0,0,1,0,0,0,1,0,1,1,1,1,0,0,
-    0,1,0,0,0,0,0,1,0,1,0,1,0,0,1,1,0,1,0,0,1,0,0,0,1,0,1,1,1,1,0,
-    0,0,1,0,0,0,0,0,1,0,1,0,1,0,0,1,1,0,1,0,0,1,0,0,0,1,0,1,1,1,1,
-    1,0,0,0,0,0,0,0,0,1,0,1,0,1,0,0,1,1,0,1,0,0,1,0,0,0,1,0,1,1,1,
-    1,1,0,1,0,0,0,0,0,0,1,0,1,0,1,0,0,1,1,0,1,0,0,1,0,0,0,1,0,1,1,
-    1,1,1,1,1,0,0,0,0,0,0,1,0,1,0,1,0,0,1,1,0,1,0,0,1,0,0,0,1,0,1,
-    1,1,1,0,1,1,0,0,0,0,0,0,1,0,1,0,1,0,0,1,1,0,1,0,0,1,0,0,0,1,0,
-    0,1,1,1,0,1,1,0,0,0,0,0,0,1,0,1,0,1,0,0,1,1,0,1,0,0,1,0,0,0,1,
-    1,0,1,0,1,0,1,1,0,0,0,0,0,0,1,0,1,0,1,0,0,1,1,0,1,0,0,1,0,0,0
-  };
-  const static bmat x1_p1600_mat(x1_p1600_cmat,31,31);
-  const static bin x2_p1600_cmat [] = {
-    0,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,1,1,0,0,1,0,0,0,0,0,0,0,
-    0,0,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,1,1,0,0,1,0,0,0,0,0,0,
-    0,0,0,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,1,1,0,0,1,0,0,0,0,0,
-    0,0,0,0,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,1,1,0,0,1,0,0,0,0,
-    0,0,0,0,0,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,1,1,0,0,1,0,0,0,
-    0,0,0,0,0,0,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,1,1,0,0,1,0,0,
-    0,0,0,0,0,0,0,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,1,1,0,0,1,0,
-    0,0,0,0,0,0,0,0,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,1,1,0,0,1,
-    1,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,1,1,0,0,
-    0,1,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,1,1,0,
-    0,0,1,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,1,1,
-    1,1,1,0,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,1,
-    1,0,0,0,0,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,
-    0,1,0,0,0,0,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,
-    0,0,1,0,0,0,0,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,
-    1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,
-    0,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,1,0,0,0,1,0,0,
-    0,0,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,1,0,0,0,1,0,
-    0,0,0,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,1,0,0,0,1,
-    1,1,1,1,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,1,0,0,0,
-    0,1,1,1,1,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,1,0,0,
-    0,0,1,1,1,1,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,1,0,
-    0,0,0,1,1,1,1,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,1,
-    1,1,1,1,1,1,1,1,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,
-    0,1,1,1,1,1,1,1,1,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,0,1,1,1,0,0,0,
-    0,0,1,1,1,1,1,1,1,1,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,0,1,1,1,0,0,
-    0,0,0,1,1,1,1,1,1,1,1,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,0,1,1,1,0,
-    0,0,0,0,1,1,1,1,1,1,1,1,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,0,1,1,1,
-    1,1,1,1,0,1,1,1,1,1,1,1,1,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,0,1,1,
-    1,0,0,0,1,0,1,1,1,1,1,1,1,1,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,0,1,
-    1,0,1,1,0,1,0,1,1,1,1,1,1,1,1,1,1,1,0,0,0,0,0,1,1,1,0,0,0,0,0
-  };
-  const static bmat x2_p1600_mat(x2_p1600_cmat,31,31);
+  uint32 x1=1;
+  uint32 x2=c_init&0x7FFFFFFF;
 
   // Advance the state machines by 1600 clocks.
-  x1=x1_p1600_mat*x1;
-  x2=x2_p1600_mat*x2;
+  // x1(n+31)=mod(x1(n+3)+x1(n),2)
+  // x2(n+31)=mod(x2(n+3)+x2(n+2)+x2(n+1)+x2(n),2)
+  for (uint16 t=0;t<1600;t++) {
+    x1=(x1>>1)|((((x1>>3)^x1)&1)<<30);
+    x2=(x2>>1)|((((x2>>3)^(x2>>2)^(x2>>1)^x2)&1)<<30);
+  }
 
   // Create output vector
   bvec rv(len);
   for (uint32 t=0;t<len;t++) {
     // Store output
-    rv(t)=x1(0)+x2(0);
+    rv(t)=(x1^x2)&1;
     // Advance state machines
-    bool x1_new=x1(0)+x1(3);
-    bool x2_new=x2(0)+x2(1)+x2(2)+x2(3);
-    for (uint8 k=0;k<30;k++) {
-      x1(k)=x1(k+1);
-      x2(k)=x2(k+1);
-    }
-    x1(30)=x1_new;
-    x2(30)=x2_new;
+    x1=(x1>>1)|((((x1>>3)^x1)&1)<<30);
+    x2=(x2>>1)|((((x2>>3)^(x2>>2)^(x2>>1)^x2)&1)<<30);
   }
 
   return rv;
@@ -208,26 +133,25 @@ ivec sss_fd_calc(
   const uint32 m0=itpp_ext::matlab_mod(mp,31);
   const uint32 m1=itpp_ext::matlab_mod(m0+floor_i(mp/31)+1,31);
 
+  // The three m-sequences are the same for every call; parse the string
+  // literals only once.
   //s_td=[0 0 0 0 1];
   //for t=1:26
   //  s_td=[s_td mod(s_td(end-2)+s_td(end-4),2)];
   //end
-  ivec s_td("0 0 0 0 1 0 0 1 0 1 1 0 0 1 1 1 1 1 0 0 0 1 1 0 1 1 1 0 1 0 1");
-  s_td=1-2*s_td;
+  const static ivec s_td=1-2*ivec("0 0 0 0 1 0 0 1 0 1 1 0 0 1 1 1 1 1 0 0 0 1 1 0 1 1 1 0 1 0 1");
 
   //c_td=[0 0 0 0 1];
   //for t=1:26
   //  c_td=[c_td mod(c_td(end-1)+c_td(end-4),2)];
   //end
-  ivec c_td("0 0 0 0 1 0 1 0 1 1 1 0 1 1 0 0 0 1 1 1 1 1 0 0 1 1 0 1 0 0 1");
-  c_td=1-2*c_td;
+  const static ivec c_td=1-2*ivec("0 0 0 0 1 0 1 0 1 1 1 0 1 1 0 0 0 1 1 1 1 1 0 0 1 1 0 1 0 0 1");
 
   //z_td=[0 0 0 0 1];
   //for t=1:26
   //  z_td=[z_td mod(z_td(end)+z_td(end-2)+z_td(end-3)+z_td(end-4),2)];
   //end
-  ivec z_td("0 0 0 0 1 1 1 0 0 1 1 0 1 1 1 1 1 0 1 0 0 0 1 0 0 1 0 1 0 1 1");
-  z_td=1-2*z_td;
+  const static ivec z_td=1-2*ivec("0 0 0 0 1 1 1 0 0 1 1 0 1 1 1 1 1 0 1 0 0 0 1 0 0 1 0 1 0 1 1");
 
   ivec s0_m0=s_td(itpp_ext::matlab_mod(itpp_ext::matlab_range(m0,30+m0),31));
   ivec s1_m1=s_td(itpp_ext::matlab_mod(itpp_ext::matlab_range(m1,30+m1),31));
@@ -535,18 +459,108 @@ bmat lte_conv_encode(
 // Note that this function assumes that d_est is ln(P(d_est==0|r)/P(d_est==1|r))
 // This is different from the matlab function which assumes d_est
 // is simply P(d_est==0|r).
+//
+// ML tail-biting decode of the rate 1/3, K=7 code, implemented directly
+// instead of through IT++. The decision rule is the same one the IT++
+// decoder used (one Viterbi pass per possible start state, forcing the
+// path to start and end in that state), but the trellis is flattened
+// into contiguous arrays so that the 64-state add-compare-select loop is
+// branch-predictable and vectorizable. decode_mib() runs this for every
+// frame alignment/ antenna hypothesis, so it is the hottest compute
+// block of the MIB confirmation stage.
 bvec lte_conv_decode(
   const mat & d_est
 ) {
-  Convolutional_Code coder;
-  ivec generator(3);
-  generator(0)=0133;
-  generator(1)=0171;
-  generator(2)=0165;
-  coder.set_generator_polynomials(generator,7);
+  const int32 n=d_est.cols();
+  ASSERT(d_est.rows()==3);
+
+  // Encoder polynomials. Bit 6 of each generator is the coefficient of
+  // the current input bit.
+  const uint8 generator[3]={0133,0171,0165};
+
+  // Precompute the encoder output signs (+1 for coded bit 0, -1 for
+  // coded bit 1) for all 128 combinations of state and input bit. The
+  // table index is (input_bit<<6)|state.
+  float out_sign[128*3];
+  for (uint8 full=0;full<128;full++) {
+    for (uint8 j=0;j<3;j++) {
+      uint8 par=full&generator[j];
+      par^=par>>4;
+      par^=par>>2;
+      par^=par>>1;
+      out_sign[full*3+j]=(par&1)?-1.0:1.0;
+    }
+  }
+
+  // Flatten the branch metrics of every trellis step into contiguous
+  // memory. 0 is received as +1 and 1 as -1, so the metric of a branch
+  // is the correlation of the soft values with the branch's output
+  // signs.
+  vector <float> bm(n*128);
+  for (int32 t=0;t<n;t++) {
+    const float r0=d_est(0,t);
+    const float r1=d_est(1,t);
+    const float r2=d_est(2,t);
+    float * const bm_t=&bm[t*128];
+    for (uint8 full=0;full<128;full++) {
+      bm_t[full]=r0*out_sign[full*3]+r1*out_sign[full*3+1]+r2*out_sign[full*3+2];
+    }
+  }
+
+  // Try all 64 possible start states. For each one, run a Viterbi pass
+  // whose path is forced to start and end in that state and keep the
+  // best path found. This is an exhaustive ML tail-biting search; its
+  // cost is dominated by the ACS loop below, which touches only the
+  // small contiguous metric arrays.
+  vector <uint8> tb(n*64);
+  vector <uint8> tb_best(n*64);
+  float best_metric=-1e30;
+  uint8 best_ss=0;
+  float pm_buf_a[64];
+  float pm_buf_b[64];
+  for (uint8 ss=0;ss<64;ss++) {
+    float * pm=pm_buf_a;
+    float * pm_new=pm_buf_b;
+    for (uint8 s=0;s<64;s++) {
+      pm[s]=-1e30;
+    }
+    pm[ss]=0;
+    for (int32 t=0;t<n;t++) {
+      const float * const bm_t=&bm[t*128];
+      uint8 * const tb_t=&tb[t*64];
+      // Add-compare-select over all 64 destination states. State s
+      // advances to ((b<<6)|s)>>1 on input bit b, so destination ns has
+      // input bit ns>>5 and predecessors ((ns&31)<<1) and
+      // ((ns&31)<<1)|1.
+      for (uint8 ns=0;ns<64;ns++) {
+        const uint8 b=ns>>5;
+        const uint8 s0=(ns&31)<<1;
+        const float m0=pm[s0]+bm_t[(b<<6)|s0];
+        const float m1=pm[s0+1]+bm_t[(b<<6)|s0|1];
+        const uint8 p=(m1>m0);
+        pm_new[ns]=p?m1:m0;
+        tb_t[ns]=p;
+      }
+      float * const temp=pm;
+      pm=pm_new;
+      pm_new=temp;
+    }
+    if (pm[ss]>best_metric) {
+      best_metric=pm[ss];
+      best_ss=ss;
+      tb_best=tb;
+    }
+  }
+
+  // Trace back the winning tail-biting path. The top bit of each state
+  // is the input bit that led into it.
+  bvec c_est(n);
+  uint8 state=best_ss;
+  for (int32 t=n-1;t>=0;t--) {
+    c_est(t)=state>>5;
+    state=((state&31)<<1)|tb_best[t*64+state];
+  }
 
-  vec d_est_v=cvectorize(d_est);
-  bvec c_est=coder.decode_tailbite(d_est_v);
   return c_est;
 }
 
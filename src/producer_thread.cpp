@@ -51,7 +51,15 @@ typedef struct {
   uint32 target_cap_start_time;
   bool filling;
   uint16 buffer_offset;
-  td_fifo_pdu_t pdu;
+  // Slot and symbol number of the PDU currently (or next) being filled.
+  uint8 slot_num;
+  uint8 sym_num;
+  // PDU currently being filled. NULL when not filling.
+  td_fifo_pdu_t * pdu;
+  // Completed PDUs waiting to be delivered to the tracker as one batch.
+  std::vector <td_fifo_pdu_t *> batch;
+  // Recycled PDU buffers taken back from the tracker's pool.
+  std::vector <td_fifo_pdu_t *> local_pool;
 } cell_local_t;
 
 // Process that takes samples and distributes them to the appropriate
@@ -61,6 +69,7 @@ void producer_thread(
   capbuf_sync_t & capbuf_sync,
   global_thread_data_t & global_thread_data,
   tracked_cell_list_t & tracked_cell_list,
+  tracker_pool_t & tracker_pool,
   double & fc
 ) {
   global_thread_data.producer_thread_id=syscall(SYS_gettid);
@@ -70,6 +79,7 @@ void producer_thread(
   cell_local_t cell_local[504];
   for (uint16 t=0;t<504;t++) {
     cell_local[t].serial_num=0;
+    cell_local[t].pdu=NULL;
   }
 
   //Real_Timer tt;
@@ -106,28 +116,29 @@ void producer_thread(
     vec samples_timestamp(BLOCK_SIZE);
     uint32 n_samples;
     {
-      boost::mutex::scoped_lock lock(sampbuf_sync.mutex);
+      // Wait until at least one complete IQ sample is available. The
+      // ring is lock-free so there is no condition variable to wait
+      // on; a short sleep is fine since the USB callback delivers
+      // blocks that are several ms long.
       while (sampbuf_sync.fifo.size()<2) {
-        sampbuf_sync.condition.wait(lock);
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
       }
       // Dump data if there is too much in the fifo
       while (sampbuf_sync.fifo.size()>2*FS_LTE/16*1.5) {
-        for (uint32 t=0;t<(unsigned)round_i(fs_programmed*k_factor);t++) {
-          sampbuf_sync.fifo.pop_front();
-        }
+        sampbuf_sync.fifo.discard((unsigned)round_i(fs_programmed*k_factor));
         global_thread_data.raw_seconds_dropped_inc();
       }
-      n_samples=BLOCK_SIZE;
+      // Pull out as many whole IQ sample pairs as are available, up to
+      // one block's worth, in one bulk copy.
+      uint8 raw[2*BLOCK_SIZE];
+      const uint32 n_avail=sampbuf_sync.fifo.size()&~1U;
+      const uint32 n_bytes=MIN(n_avail,2*BLOCK_SIZE);
+      sampbuf_sync.fifo.read(raw,n_bytes);
+      n_samples=n_bytes>>1;
       complex <double> sample_temp;
-      for (uint16 t=0;t<BLOCK_SIZE;t++) {
-        if (sampbuf_sync.fifo.size()<2) {
-          n_samples=t;
-          break;
-        }
-        sample_temp.real()=(sampbuf_sync.fifo.front()-127.0)/128.0;
-        sampbuf_sync.fifo.pop_front();
-        sample_temp.imag()=(sampbuf_sync.fifo.front()-127.0)/128.0;
-        sampbuf_sync.fifo.pop_front();
+      for (uint16 t=0;t<n_samples;t++) {
+        sample_temp.real()=(raw[(t<<1)]-127.0)/128.0;
+        sample_temp.imag()=(raw[(t<<1)+1]-127.0)/128.0;
         samples(t)=sample_temp;
         sample_time+=(FS_LTE/16)/(fs_programmed*k_factor);
         //sample_time=itpp_ext::matlab_mod(sample_time,19200.0);
@@ -167,9 +178,11 @@ void producer_thread(
       list <tracked_cell_t *>::iterator it=tracked_cell_list.tracked_cells.begin();
       while (it!=tracked_cell_list.tracked_cells.end()) {
         tracked_cell_t & tracked_cell=(*(*it));
-        // See if this thread has been launched yet. If not, launch it.
+        // See if this cell has been handed to the worker pool yet. If not,
+        // schedule its first (empty) service so that a worker initializes
+        // the cell's processing state and marks it ready for data.
         if (!tracked_cell.launched) {
-          tracked_cell.thread=boost::thread(tracker_thread,boost::ref(tracked_cell),boost::ref(global_thread_data));
+          tracker_pool.schedule(tracked_cell);
           tracked_cell.launched=true;
         }
         double frame_timing=tracked_cell.frame_timing();
@@ -179,17 +192,49 @@ void producer_thread(
         // Initialize local storage if necessary
         if (tracked_cell.serial_num!=cl.serial_num) {
           cl.serial_num=tracked_cell.serial_num;
-          cl.pdu.slot_num=0;
-          cl.pdu.sym_num=0;
+          cl.slot_num=0;
+          cl.sym_num=0;
           cl.target_cap_start_time=(tracked_cell.cp_type==cp_type_t::NORMAL)?10:32;
           cl.filling=false;
           cl.buffer_offset=0;
-          if (cl.serial_num==1)
-            cl.pdu.data.set_size(128);
+          // Drop anything left over from a previous cell with this ID.
+          if (cl.pdu!=NULL) {
+            delete cl.pdu;
+            cl.pdu=NULL;
+          }
+          for (uint32 k=0;k<cl.batch.size();k++) {
+            delete cl.batch[k];
+          }
+          cl.batch.clear();
+          for (uint32 k=0;k<cl.local_pool.size();k++) {
+            delete cl.local_pool[k];
+          }
+          cl.local_pool.clear();
         }
 
-        // Delete the tracker if lock has been lost.
+        // Delete the tracker if lock has been lost. If a service job for
+        // the cell is still pending or running in the worker pool, leave
+        // the cell alone for now; it will be deleted on a later pass once
+        // the worker has let go of it.
         if (tracked_cell.kill_me) {
+          if (tracker_pool.in_service(tracked_cell)) {
+            ++it;
+            continue;
+          }
+          // The cell object (and its PDU pool) is going away; free the
+          // PDUs held locally for this cell as well.
+          if (cl.pdu!=NULL) {
+            delete cl.pdu;
+            cl.pdu=NULL;
+          }
+          for (uint32 k=0;k<cl.batch.size();k++) {
+            delete cl.batch[k];
+          }
+          cl.batch.clear();
+          for (uint32 k=0;k<cl.local_pool.size();k++) {
+            delete cl.local_pool[k];
+          }
+          cl.local_pool.clear();
           tracked_cell_t * temp=(*it);
           it=tracked_cell_list.tracked_cells.erase(it);
           delete temp;
@@ -211,26 +256,56 @@ void producer_thread(
             ) {
               // Configure parameters for this capture
               cl.filling=true;
-              cl.pdu.late=tdiff;
+              // Grab a PDU buffer, preferring a recycled one so that
+              // the cvec storage is reused.
+              if (cl.local_pool.empty()) {
+                cl.pdu=new td_fifo_pdu_t;
+              } else {
+                cl.pdu=cl.local_pool.back();
+                cl.local_pool.pop_back();
+              }
+              if (cl.pdu->data.size()!=128)
+                cl.pdu->data.set_size(128);
+              cl.pdu->late=tdiff;
               cl.buffer_offset=0;
               // Record the frequency offset and frame timing as they were
               // at the beginning of the capture.
-              cl.pdu.frequency_offset=frequency_offset;
-              cl.pdu.frame_timing=frame_timing;
+              cl.pdu->frequency_offset=frequency_offset;
+              cl.pdu->frame_timing=frame_timing;
             }
           }
 
           // Save this sample if our state indicates we are filling the
           // buffer.
           if (cl.filling) {
-            cl.pdu.data(cl.buffer_offset++)=samples(t);
+            cl.pdu->data(cl.buffer_offset++)=samples(t);
             if (cl.buffer_offset==128) {
-              // Buffer is full! Send PDU
-              {
-                boost::mutex::scoped_lock lock2(tracked_cell.fifo_mutex);
-                tracked_cell.fifo.push(cl.pdu);
-                tracked_cell.fifo_peak_size=MAX(tracked_cell.fifo.size(),tracked_cell.fifo_peak_size);
-                tracked_cell.fifo_condition.notify_one();
+              // Buffer is full! Tag it and add it to the outgoing batch.
+              cl.pdu->slot_num=cl.slot_num;
+              cl.pdu->sym_num=cl.sym_num;
+              cl.batch.push_back(cl.pdu);
+              cl.pdu=NULL;
+              // Deliver the batch once it covers a whole subframe: one
+              // lock acquisition and one scheduling per subframe instead
+              // of one per OFDM symbol. Recycled PDUs are taken back from
+              // the tracker's pool under the same lock.
+              const uint8 n_batch=2*tracked_cell.n_symb_dl();
+              if (cl.batch.size()>=n_batch) {
+                {
+                  boost::mutex::scoped_lock lock2(tracked_cell.fifo_mutex);
+                  for (uint32 k=0;k<cl.batch.size();k++) {
+                    tracked_cell.fifo.push(cl.batch[k]);
+                  }
+                  cl.batch.clear();
+                  tracked_cell.fifo_peak_size=MAX(tracked_cell.fifo.size(),tracked_cell.fifo_peak_size);
+                  while ((cl.local_pool.size()<n_batch)&&(!tracked_cell.pdu_pool.empty())) {
+                    cl.local_pool.push_back(tracked_cell.pdu_pool.back());
+                    tracked_cell.pdu_pool.pop_back();
+                  }
+                }
+                // Hand the cell to the worker pool. No-op if a service
+                // job for it is already pending or running.
+                tracker_pool.schedule(tracked_cell);
               }
               //cout << "fifo size: " << tracked_cell.fifo.size() << endl;
               // Calculate trigger parameters of next capture
@@ -238,10 +313,10 @@ void producer_thread(
               if (tracked_cell.cp_type==cp_type_t::EXTENDED) {
                 cl.target_cap_start_time+=32+128;
               } else {
-                cl.target_cap_start_time+=(cl.pdu.sym_num==6)?128+10:128+9;
+                cl.target_cap_start_time+=(cl.sym_num==6)?128+10:128+9;
               }
               cl.target_cap_start_time=mod(cl.target_cap_start_time,19200);
-              slot_sym_inc(tracked_cell.n_symb_dl(),cl.pdu.slot_num,cl.pdu.sym_num);
+              slot_sym_inc(tracked_cell.n_symb_dl(),cl.slot_num,cl.sym_num);
             }
           }
         }
@@ -47,9 +47,11 @@
 #include <itpp/stat/misc_stat.h>
 #include <math.h>
 #include <list>
+#include <queue>
 #include <iomanip>
 #include <algorithm>
 #include <vector>
+#include <atomic>
 #include <boost/math/special_functions/gamma.hpp>
 #include "rtl-sdr.h"
 #include "common.h"
@@ -106,34 +108,123 @@
 using namespace itpp;
 using namespace std;
 
-// Correlate the received data against various frequency shifted versions
-// of the three PSS sequences.
-// This is likely to be the slowest routine since it needs to process so
-// much data.
-void xc_correlate(
+// Cache of the frequency shifted, conjugated, and scaled PSS templates
+// for one particular combination of center frequency, sampling rate,
+// and frequency offset search set.
+//
+// CellSearch calls xcorr_pss() with the identical f_search_set for
+// every center frequency step and LTE-Tracker's searcher runs forever
+// on one center frequency, so recomputing fshift()/conj() (three
+// temporary cvec allocations per hypothesis) inside the hottest
+// function is pure waste. The templates are materialized once into
+// contiguous float storage that the correlation loops read directly;
+// the frequency domain forms needed by the overlap-save engine are
+// cached alongside.
+class pss_template_cache_t {
+  public:
+    // FFT block size used by the overlap-save correlation engine.
+    static const uint32 n_fft=1024;
+
+    pss_template_cache_t(void) : fc_requested(NAN),fc_programmed(NAN),fs_programmed(NAN) { }
+
+    // Rebuild the templates if any of the inputs have changed since the
+    // previous call. Returns immediately on the hit path.
+    void update(
+      const vec & f_search_set,
+      const double & fc_requested,
+      const double & fc_programmed,
+      const double & fs_programmed
+    ) {
+      const uint16 n_f=length(f_search_set);
+      bool hit=(fc_requested==this->fc_requested)&&(fc_programmed==this->fc_programmed)&&(fs_programmed==this->fs_programmed)&&(n_f==length(this->f_search_set));
+      for (uint16 foi=0;hit&&(foi<n_f);foi++) {
+        hit=(f_search_set(foi)==this->f_search_set(foi));
+      }
+      if (hit)
+        return;
+
+      this->fc_requested=fc_requested;
+      this->fc_programmed=fc_programmed;
+      this->fs_programmed=fs_programmed;
+      this->f_search_set=f_search_set;
+      re.resize((uint32)n_f*3*137);
+      im.resize((uint32)n_f*3*137);
+      fd.resize((uint32)n_f*3);
+      for (uint16 foi=0;foi<n_f;foi++) {
+        const double f_off=f_search_set(foi);
+        const double k_factor=(fc_requested-f_off)/fc_programmed;
+        for (uint8 t=0;t<3;t++) {
+          cvec temp=ROM_TABLES.pss_td[t];
+          temp=fshift(temp,f_off,fs_programmed*k_factor);
+          temp=conj(temp)/137;
+          float * const t_re=&re[((uint32)foi*3+t)*137];
+          float * const t_im=&im[((uint32)foi*3+t)*137];
+          for (uint8 m=0;m<137;m++) {
+            t_re[m]=temp(m).real();
+            t_im[m]=temp(m).imag();
+          }
+          // Time-reverse the template so that the circular convolution
+          // performed by the overlap-save engine produces the desired
+          // correlation lags.
+          cvec temp_rev=zeros_c(n_fft);
+          for (uint8 m=0;m<137;m++) {
+            temp_rev(m)=temp(136-m);
+          }
+          fd[(uint32)foi*3+t]=fft_cached(temp_rev);
+        }
+      }
+    }
+
+    // Contiguous I/Q taps for hypothesis (f_off index, PSS index).
+    inline const float * re_ptr(const uint16 & foi,const uint8 & t) const {
+      return &re[((uint32)foi*3+t)*137];
+    }
+    inline const float * im_ptr(const uint16 & foi,const uint8 & t) const {
+      return &im[((uint32)foi*3+t)*137];
+    }
+    // Frequency domain template of length n_fft.
+    inline const cvec & fd_template(const uint16 & foi,const uint8 & t) const {
+      return fd[(uint32)foi*3+t];
+    }
+
+  private:
+    double fc_requested;
+    double fc_programmed;
+    double fs_programmed;
+    vec f_search_set;
+    vector <float> re;
+    vector <float> im;
+    vector <cvec> fd;
+};
+
+// Direct time-domain implementation of the PSS correlation. This is the
+// reference implementation and is also used for captures that are too
+// short to be worth processing in FFT blocks.
+static void xc_correlate_td(
   // Inputs
   const cvec & capbuf,
   const vec & f_search_set,
-  const double & fc_requested,
-  const double & fc_programmed,
-  const double & fs_programmed,
+  const pss_template_cache_t & templates,
   // Outputs
   vcf3d & xc
 ) {
   const uint32 n_cap=length(capbuf);
   const uint16 n_f=length(f_search_set);
 
-  // Set aside space for the vector and initialize with NAN's.
-#ifndef NDEBUG
-  xc=vector < vector < vector < complex < float > > > > (3,vector< vector < complex < float > > >(n_cap-136, vector < complex < float > > (n_f,NAN)));
-#else
-  xc=vector < vector < vector < complex < float > > > > (3,vector< vector < complex < float > > >(n_cap-136, vector < complex < float > > (n_f)));
-#endif
+  // The correlation output is only stored as complex<float>, so the
+  // multiply-accumulate can be performed entirely in single precision
+  // without any loss in the stored result. Convert the capture buffer
+  // once into separate contiguous I and Q float arrays; the split
+  // storage lets the compiler vectorize the inner loop into wide FMA's
+  // instead of chasing cvec element accessors.
+  vector <float> cap_re(n_cap);
+  vector <float> cap_im(n_cap);
+  for (uint32 n=0;n<n_cap;n++) {
+    cap_re[n]=capbuf(n).real();
+    cap_im[n]=capbuf(n).imag();
+  }
 
   // Local variables declared outside of the loop.
-  double f_off;
-  cvec temp;
-  complex <double> acc;
   uint16 foi;
   uint8 t;
   uint32 k;
@@ -143,36 +234,264 @@ void xc_correlate(
   //Real_Timer tt;
   //tt.tic();
   for (foi=0;foi<n_f;foi++) {
-    f_off=f_search_set(foi);
-    double k_factor=(fc_requested-f_off)/fc_programmed;
     for (t=0;t<3;t++) {
-      temp=ROM_TABLES.pss_td[t];
-      temp=fshift(temp,f_off,fs_programmed*k_factor);
-      temp=conj(temp)/137;
+      const float * const temp_re=templates.re_ptr(foi,t);
+      const float * const temp_im=templates.im_ptr(foi,t);
+      // The time dimension of xc is contiguous for a fixed (t,foi).
+      complex <float> * const xc_out=xc.row_ptr(t,foi);
 #ifdef _OPENMP
-#pragma omp parallel for shared(temp,capbuf,xc) private(k,acc,m)
+#pragma omp parallel for shared(temp_re,temp_im,cap_re,cap_im,xc_out) private(k,m)
 #endif
       for (k=0;k<n_cap-136;k++) {
-        acc=0;
+        // Correlations are performed at the 2x rate which effectively
+        // performs filtering and correlating at the same time. Thus,
+        // this algorithm can handle huge frequency offsets limited only
+        // by the bandwidth of the capture device.
+        // Correlations can also be done at the 1x rate if filtering is
+        // peformed first, but this will limit the set of frequency offsets
+        // that this algorithm can detect. 1x rate correlations will,
+        // however, be nearly twice as fast as the 2x correlations
+        // performed here.
+        float acc_re=0;
+        float acc_im=0;
         for (m=0;m<137;m++) {
-          // Correlations are performed at the 2x rate which effectively
-          // performs filtering and correlating at the same time. Thus,
-          // this algorithm can handle huge frequency offsets limited only
-          // by the bandwidth of the capture device.
-          // Correlations can also be done at the 1x rate if filtering is
-          // peformed first, but this will limit the set of frequency offsets
-          // that this algorithm can detect. 1x rate correlations will,
-          // however, be nearly twice as fast as the 2x correlations
-          // performed here.
-          acc+=temp(m)*capbuf(k+m);
+          acc_re+=temp_re[m]*cap_re[k+m]-temp_im[m]*cap_im[k+m];
+          acc_im+=temp_re[m]*cap_im[k+m]+temp_im[m]*cap_re[k+m];
         }
-        xc[t][k][foi]=acc;
+        xc_out[k]=complex <float> (acc_re,acc_im);
       }
     }
   }
   //tt.toc_print();
 }
 
+// FFT-based (overlap-save) implementation of the PSS correlation.
+//
+// The correlation of the capture buffer against a 137 tap template is a
+// convolution against the time-reversed template and can therefore be
+// performed blockwise in the frequency domain. Each FFT block of length
+// n_fft produces n_fft-136 valid correlation lags, so the per-lag cost
+// drops from 137 complex MAC's to a few butterflies.
+//
+// The frequency shift of each search hypothesis is folded into the
+// template (exactly as in the time-domain implementation) and hence the
+// forward transforms of the capture buffer blocks only need to be
+// calculated once and can be shared between all frequency and PSS
+// hypotheses.
+static void xc_correlate_fft(
+  // Inputs
+  const cvec & capbuf,
+  const vec & f_search_set,
+  const pss_template_cache_t & templates,
+  // Outputs
+  vcf3d & xc
+) {
+  const uint32 n_cap=length(capbuf);
+  const uint16 n_f=length(f_search_set);
+
+  // Each block of n_fft samples overlaps the previous block by 136
+  // samples and produces n_fft-136 correlation outputs.
+  const uint32 n_fft=pss_template_cache_t::n_fft;
+  const uint32 n_advance=n_fft-136;
+  const uint32 n_blocks=(n_cap-136+n_advance-1)/n_advance;
+
+  // Transform the capture buffer blocks. The final block is zero padded.
+  vector <cvec> capbuf_fd(n_blocks);
+  for (uint32 b=0;b<n_blocks;b++) {
+    cvec block=zeros_c(n_fft);
+    const uint32 n_copy=MIN(n_fft,n_cap-b*n_advance);
+    for (uint32 m=0;m<n_copy;m++) {
+      block(m)=capbuf(b*n_advance+m);
+    }
+    capbuf_fd[b]=fft_cached(block);
+  }
+
+  // Local variables declared outside of the loop.
+  uint16 foi;
+  uint8 t;
+  uint32 b;
+  uint32 m;
+
+  for (foi=0;foi<n_f;foi++) {
+    for (t=0;t<3;t++) {
+      const cvec & temp_fd=templates.fd_template(foi,t);
+      // The time dimension of xc is contiguous for a fixed (t,foi).
+      complex <float> * const xc_out=xc.row_ptr(t,foi);
+#ifdef _OPENMP
+#pragma omp parallel for shared(temp_fd,capbuf_fd,xc_out) private(b,m)
+#endif
+      for (b=0;b<n_blocks;b++) {
+        const cvec prod=ifft_cached(elem_mult(capbuf_fd[b],temp_fd));
+        // The first 136 outputs of each block are circularly wrapped
+        // and are discarded.
+        for (m=136;m<n_fft;m++) {
+          const uint32 k=b*n_advance+m-136;
+          if (k>=n_cap-136)
+            break;
+          xc_out[k]=prod(m);
+        }
+      }
+    }
+  }
+}
+
+// 1x-rate implementation of the PSS correlation for small frequency
+// offsets.
+//
+// The capture buffer is low-pass filtered and decimated by two through
+// a polyphase FIR and then correlated against half-length (69 tap)
+// templates formed from the even samples of the 2x oversampled PSS.
+// This performs the filtering that the 2x-rate correlation gets for
+// free, at roughly a quarter of the multiply-accumulate work, but the
+// decimation filter clips any signal shifted too far from the center
+// of the band. It is therefore only used when every hypothesis in the
+// search set is within a few kHz (TCXO-corrected dongles), where the
+// shifted PSS still fits comfortably inside the decimated bandwidth.
+//
+// Correlation lags are only produced on the even 2x-rate grid; each
+// odd lag is filled with its even neighbor. The resulting timing
+// uncertainty of one 2x sample is well within what the delay spread
+// combining downstream already tolerates.
+static void xc_correlate_1x(
+  // Inputs
+  const cvec & capbuf,
+  const vec & f_search_set,
+  const double & fc_requested,
+  const double & fc_programmed,
+  const double & fs_programmed,
+  // Outputs
+  vcf3d & xc
+) {
+  const uint32 n_cap=length(capbuf);
+  const uint16 n_f=length(f_search_set);
+
+  // Decimating low-pass: 31 tap windowed sinc with cutoff at a quarter
+  // of the input rate and unity passband gain.
+  const uint8 n_taps=31;
+  vec h(n_taps);
+  for (uint8 j=0;j<n_taps;j++) {
+    const double x=j-15.0;
+    h(j)=((x==0)?0.5:(sin(pi*x/2)/(pi*x)))*(0.54-0.46*cos(2*pi*j/(n_taps-1.0)));
+  }
+  h=h/sum(h);
+
+  // Filter and decimate. The filter is centered so that decimated
+  // sample n corresponds to capture sample 2n; edges are zero padded.
+  const uint32 n_dec=n_cap/2;
+  vector <float> dec_re(n_dec);
+  vector <float> dec_im(n_dec);
+  for (uint32 n=0;n<n_dec;n++) {
+    complex <double> acc=0;
+    for (uint8 j=0;j<n_taps;j++) {
+      const int32 idx=2*(int32)n+j-15;
+      if ((idx<0)||(idx>=(int32)n_cap))
+        continue;
+      acc+=h(j)*capbuf(idx);
+    }
+    dec_re[n]=acc.real();
+    dec_im[n]=acc.imag();
+  }
+
+  // Local variables declared outside of the loop.
+  uint16 foi;
+  uint8 t;
+  uint32 k;
+  uint8 m;
+
+  for (foi=0;foi<n_f;foi++) {
+    const double f_off=f_search_set(foi);
+    const double k_factor=(fc_requested-f_off)/fc_programmed;
+    for (t=0;t<3;t++) {
+      // Half-length template: the even samples of the oversampled PSS,
+      // shifted at the decimated rate. The search sets that select this
+      // path contain only a handful of hypotheses, so there is no need
+      // to route these templates through the template cache.
+      cvec temp(69);
+      for (m=0;m<69;m++) {
+        temp(m)=ROM_TABLES.pss_td[t](2*m);
+      }
+      temp=fshift(temp,f_off,fs_programmed*k_factor/2);
+      temp=conj(temp)/69;
+      float temp_re[69];
+      float temp_im[69];
+      for (m=0;m<69;m++) {
+        temp_re[m]=temp(m).real();
+        temp_im[m]=temp(m).imag();
+      }
+      // The time dimension of xc is contiguous for a fixed (t,foi).
+      complex <float> * const xc_out=xc.row_ptr(t,foi);
+#ifdef _OPENMP
+#pragma omp parallel for shared(temp_re,temp_im,dec_re,dec_im,xc_out) private(k,m)
+#endif
+      for (k=0;k<n_dec-68;k++) {
+        float acc_re=0;
+        float acc_im=0;
+        for (m=0;m<69;m++) {
+          acc_re+=temp_re[m]*dec_re[k+m]-temp_im[m]*dec_im[k+m];
+          acc_im+=temp_re[m]*dec_im[k+m]+temp_im[m]*dec_re[k+m];
+        }
+        const complex <float> v(acc_re,acc_im);
+        if (2*k<n_cap-136)
+          xc_out[2*k]=v;
+        if (2*k+1<n_cap-136)
+          xc_out[2*k+1]=v;
+      }
+    }
+  }
+}
+
+// Correlate the received data against various frequency shifted versions
+// of the three PSS sequences.
+// This is likely to be the slowest routine since it needs to process so
+// much data.
+void xc_correlate(
+  // Inputs
+  const cvec & capbuf,
+  const vec & f_search_set,
+  const double & fc_requested,
+  const double & fc_programmed,
+  const double & fs_programmed,
+  // Outputs
+  vcf3d & xc
+) {
+  const uint32 n_cap=length(capbuf);
+  const uint16 n_f=length(f_search_set);
+
+  // Set aside space for the tensor and initialize with NAN's.
+#ifndef NDEBUG
+  xc=vcf3d(3,n_cap-136,n_f,NAN);
+#else
+  xc=vcf3d(3,n_cap-136,n_f);
+#endif
+
+  // When every frequency offset hypothesis is small (the search grid a
+  // TCXO-corrected dongle produces), the faster decimated 1x-rate
+  // correlation can be used; see xc_correlate_1x for the bandwidth
+  // argument behind the 5kHz bound.
+  double max_f_off=0;
+  for (uint16 foi=0;foi<n_f;foi++) {
+    max_f_off=MAX(max_f_off,abs(f_search_set(foi)));
+  }
+  if ((max_f_off<=5e3)&&(n_cap>=1024)) {
+    xc_correlate_1x(capbuf,f_search_set,fc_requested,fc_programmed,fs_programmed,xc);
+    return;
+  }
+
+  // One cache per thread so that the concurrent searches performed in
+  // CellSearch's multi-device mode (which use different center
+  // frequencies) neither contend on a lock nor evict each other.
+  static thread_local pss_template_cache_t templates;
+  templates.update(f_search_set,fc_requested,fc_programmed,fs_programmed);
+
+  // The overlap-save engine needs at least one full FFT block of data.
+  // Anything shorter (only seen in testcases) uses the direct correlation.
+  if (n_cap<pss_template_cache_t::n_fft) {
+    xc_correlate_td(capbuf,f_search_set,templates,xc);
+  } else {
+    xc_correlate_fft(capbuf,f_search_set,templates,xc);
+  }
+}
+
 // Estimate the received signal power within 2 OFDM symbols of a particular
 // sample.
 //
@@ -220,7 +539,9 @@ void sp_est(
   tshift(sp_incoherent,137);
 }
 
-// Perform incoherent combining on the correlations.
+// Perform incoherent combining on the correlations, combine adjacent taps
+// according to the expected delay spread, and collapse across the frequency
+// offset hypotheses, all in one pass.
 //
 // There is no guarantee that PSS/SSS pairs will always be transmitted from
 // the same antenna. Thus, PSS/SSS pairs separated by 5ms can only be combined
@@ -260,7 +581,16 @@ void sp_est(
 // be aligned with a spacing of 19200 samples and thus it is possible
 // to determine boht that the true downlink center frequency is 740MHz and
 // that the frequency error of the local oscillator is 0Hz.
-void xc_combine(
+//
+// The incoherent sums, the delay spread combining
+// (xc_incoherent(t,idx,foi)=mean(xc_incoherent_single(t,idx-ds_comb_arm:idx+ds_comb_arm,foi))
+// and the collapse (keeping, for each time offset and PSS index, only the
+// strongest frequency offset) used to be three separate functions that each
+// re-traversed the 3x9600xn_f arrays from DRAM. All three are memory bound,
+// so they are fused here: each 9600 sample row is squared/summed, smoothed,
+// and folded into the running frequency maximum while it is still resident
+// in cache.
+void xc_combine_collapse(
   // Inputs
   const cvec & capbuf,
   const vcf3d & xc,
@@ -268,8 +598,12 @@ void xc_combine(
   const double & fc_programmed,
   const double & fs_programmed,
   const vec & f_search_set,
+  const uint8 & ds_comb_arm,
   // Outputs
   vf3d & xc_incoherent_single,
+  vf3d & xc_incoherent,
+  mat & xc_incoherent_collapsed_pow,
+  imat & xc_incoherent_collapsed_frq,
   uint16 & n_comb_xc
 ) {
   const uint16 n_f=f_search_set.length();
@@ -277,107 +611,87 @@ void xc_combine(
 
   // Create space for some arrays
 #ifndef NDEBUG
-  xc_incoherent_single=vector < vector < vector < float > > > (3,vector< vector < float > >(9600, vector < float > (n_f,NAN)));
+  xc_incoherent_single=vf3d(3,9600,n_f,NAN);
+  xc_incoherent=vf3d(3,9600,n_f,NAN);
 #else
-  xc_incoherent_single=vector < vector < vector < float > > > (3,vector< vector < float > >(9600, vector < float > (n_f)));
+  xc_incoherent_single=vf3d(3,9600,n_f);
+  xc_incoherent=vf3d(3,9600,n_f);
 #endif
-  for (uint16 foi=0;foi<n_f;foi++) {
-    // Combine incoherently
-    const double f_off=f_search_set[foi];
-    const double k_factor=(fc_requested-f_off)/fc_programmed;
-    for (uint8 t=0;t<3;t++) {
-      for (uint16 idx=0;idx<9600;idx++) {
-        xc_incoherent_single[t][idx][foi]=0;
+  xc_incoherent_collapsed_pow=mat(3,9600);
+  xc_incoherent_collapsed_frq=imat(3,9600);
+#ifndef NDEBUG
+  xc_incoherent_collapsed_pow=NAN;
+  xc_incoherent_collapsed_frq=-1;
+#endif
+
+  // Local variables declared outside of the loop.
+  uint16 foi;
+  uint16 idx;
+  uint16 m;
+  uint8 d;
+
+  for (uint8 t=0;t<3;t++) {
+#ifdef _OPENMP
+#pragma omp parallel for shared(xc_incoherent_single,xc_incoherent) private(foi,idx,m,d)
+#endif
+    for (foi=0;foi<n_f;foi++) {
+      // Combine incoherently. The rows below are contiguous in memory.
+      float * const single_row=xc_incoherent_single.row_ptr(t,foi);
+      const complex <float> * const xc_row=xc.row_ptr(t,foi);
+      const double f_off=f_search_set[foi];
+      const double k_factor=(fc_requested-f_off)/fc_programmed;
+      for (idx=0;idx<9600;idx++) {
+        single_row[idx]=0;
       }
-      for (uint16 m=0;m<n_comb_xc;m++) {
+      for (m=0;m<n_comb_xc;m++) {
         // Because of the large supported frequency offsets and the large
         // amount of time represented by the capture buffer, the length
         // in samples, of a frame varies by the frequency offset.
         //double actual_time_offset=m*.005*k_factor;
         //double actual_start_index=itpp::round_i(actual_time_offset*FS_LTE/16);
-        double actual_start_index=itpp::round_i(m*.005*k_factor*fs_programmed);
-        for (uint16 idx=0;idx<9600;idx++) {
-          xc_incoherent_single[t][idx][foi]+=sqr(xc[t][idx+actual_start_index][foi]);
+        const uint32 actual_start_index=itpp::round_i(m*.005*k_factor*fs_programmed);
+        const complex <float> * const src=xc_row+actual_start_index;
+        for (idx=0;idx<9600;idx++) {
+          single_row[idx]+=sqr(src[idx]);
         }
       }
-      for (uint16 idx=0;idx<9600;idx++) {
-        xc_incoherent_single[t][idx][foi]=xc_incoherent_single[t][idx][foi]/n_comb_xc;
+      for (idx=0;idx<9600;idx++) {
+        single_row[idx]=single_row[idx]/n_comb_xc;
       }
-    }
-  }
-}
 
-// Combine adjacent taps that likely come from the same channel.
-// Simply: xc_incoherent(t,idx,foi)=mean(xc_incoherent_single(t,idx-ds_comb_arm:idx+ds_comb_arm,foi);
-void xc_delay_spread(
-  // Inputs
-  const vf3d & xc_incoherent_single,
-  const uint8 & ds_comb_arm,
-  // Outputs
-  vf3d & xc_incoherent
-) {
-  const int n_f=xc_incoherent_single[0][0].size();
-
-  // Create space for some arrays
-#ifndef NDEBUG
-  xc_incoherent=vector < vector < vector < float > > > (3,vector< vector < float > >(9600, vector < float > (n_f,NAN)));
-#else
-  xc_incoherent=vector < vector < vector < float > > > (3,vector< vector < float > >(9600, vector < float > (n_f)));
-#endif
-  for (uint16 foi=0;foi<n_f;foi++) {
-    for (uint8 t=0;t<3;t++) {
-      for (uint16 idx=0;idx<9600;idx++) {
-        xc_incoherent[t][idx][foi]=xc_incoherent_single[t][idx][foi];
-      }
-    }
-    for (uint8 t=1;t<=ds_comb_arm;t++) {
-      for (uint8 k=0;k<3;k++) {
-        for (uint16 idx=0;idx<9600;idx++) {
-          xc_incoherent[k][idx][foi]+=xc_incoherent_single[k][itpp_ext::matlab_mod(idx-t,9600)][foi]+xc_incoherent_single[k][itpp_ext::matlab_mod(idx+t,9600)][foi];
+      // Combine adjacent taps that likely come from the same channel while
+      // the incoherent sums are still in cache.
+      float * const smooth_row=xc_incoherent.row_ptr(t,foi);
+      for (idx=0;idx<9600;idx++) {
+        float acc=single_row[idx];
+        for (d=1;d<=ds_comb_arm;d++) {
+          acc+=single_row[itpp_ext::matlab_mod(idx-d,9600)]+single_row[itpp_ext::matlab_mod(idx+d,9600)];
         }
+        smooth_row[idx]=acc/(2*ds_comb_arm+1);
       }
     }
-    // Normalize
-    for (uint8 t=0;t<3;t++) {
-      for (uint16 idx=0;idx<9600;idx++) {
-        xc_incoherent[t][idx][foi]=xc_incoherent[t][idx][foi]/(2*ds_comb_arm+1);
-      }
-    }
-  }
-}
-
-// Search for the peak correlation among all frequency offsets.
-// For each time offset and each PSS index, examine the correlations
-// for all of the frequency offsets and only keep the correlation with
-// the largest magnitude.
-void xc_peak_freq(
-  // Inputs
-  const vf3d & xc_incoherent,
-  // Outputs
-  mat & xc_incoherent_collapsed_pow,
-  imat & xc_incoherent_collapsed_frq
-) {
-  const int n_f=xc_incoherent[0][0].size();
 
-  xc_incoherent_collapsed_pow=mat(3,9600);
-  xc_incoherent_collapsed_frq=imat(3,9600);
-#ifndef NDEBUG
-  xc_incoherent_collapsed_pow=NAN;
-  xc_incoherent_collapsed_frq=-1;
-#endif
-
-  for (uint8 t=0;t<3;t++) {
-    for (uint16 k=0;k<9600;k++) {
-      double best_pow=xc_incoherent[t][k][0];
-      uint16 best_idx=0;
-      for (uint16 foi=1;foi<n_f;foi++) {
-        if (xc_incoherent[t][k][foi]>best_pow) {
-          best_pow=xc_incoherent[t][k][foi];
-          best_idx=foi;
+    // Search for the peak correlation among all frequency offsets. For each
+    // time offset, examine the correlations for all of the frequency offsets
+    // and only keep the correlation with the largest magnitude. This reduces
+    // across the frequency dimension the loop above parallelizes over, so it
+    // runs as a final sweep per PSS index, streaming the unit stride rows
+    // written moments ago.
+    for (foi=0;foi<n_f;foi++) {
+      const float * const smooth_row=xc_incoherent.row_ptr(t,foi);
+      if (foi==0) {
+        for (idx=0;idx<9600;idx++) {
+          xc_incoherent_collapsed_pow(t,idx)=smooth_row[idx];
+          xc_incoherent_collapsed_frq(t,idx)=0;
+        }
+      } else {
+        for (idx=0;idx<9600;idx++) {
+          if (smooth_row[idx]>xc_incoherent_collapsed_pow(t,idx)) {
+            xc_incoherent_collapsed_pow(t,idx)=smooth_row[idx];
+            xc_incoherent_collapsed_frq(t,idx)=foi;
+          }
         }
       }
-      xc_incoherent_collapsed_pow(t,k)=best_pow;
-      xc_incoherent_collapsed_frq(t,k)=best_idx;
     }
   }
 }
@@ -408,14 +722,11 @@ void xcorr_pss(
 ) {
   // Perform correlations
   xc_correlate(capbuf,f_search_set,fc_requested,fc_programmed,fs_programmed,xc);
-  // Incoherently combine correlations
-  xc_combine(capbuf,xc,fc_requested,fc_programmed,fs_programmed,f_search_set,xc_incoherent_single,n_comb_xc);
-  // Combine according to delay spread
-  xc_delay_spread(xc_incoherent_single,ds_comb_arm,xc_incoherent);
+  // Incoherently combine correlations, combine according to delay spread,
+  // and search for peaks among all the frequency offsets, in a single pass.
+  xc_combine_collapse(capbuf,xc,fc_requested,fc_programmed,fs_programmed,f_search_set,ds_comb_arm,xc_incoherent_single,xc_incoherent,xc_incoherent_collapsed_pow,xc_incoherent_collapsed_frq,n_comb_xc);
   // Estimate received signal power
   sp_est(capbuf,sp,sp_incoherent,n_comb_sp);
-  // Search for peaks among all the frequency offsets.
-  xc_peak_freq(xc_incoherent,xc_incoherent_collapsed_pow,xc_incoherent_collapsed_frq);
 }
 
 // Search through all the correlations and determine if any PSS were found.
@@ -435,14 +746,51 @@ void peak_search(
   // Create local copy we can write to and destroy.
   mat xc_incoherent_working=xc_incoherent_collapsed_pow;
 
+  // Lazy max-heap over every (PSS,timing) entry of the working matrix.
+  // All of the cancellation rules below only ever lower entries, so a
+  // popped entry whose stored power no longer matches the working
+  // matrix is stale and can be discarded or reinserted with its
+  // current value. Extracting each successive peak then costs work
+  // proportional to the region the previous masking touched instead of
+  // a full rescan of the matrix for every peak.
+  priority_queue <pair <double,uint32> > heap;
+  for (uint8 t=0;t<3;t++) {
+    for (uint16 k=0;k<9600;k++) {
+      heap.push(make_pair(xc_incoherent_working(t,k),(uint32)t*9600+k));
+    }
+  }
+  // The CRS cancellation rule zeroes every entry of the matrix below
+  // peak_pow-12dB. Since successive peak powers are non-increasing,
+  // keeping the largest such threshold and applying it when an entry
+  // is popped is equivalent to the eager full-matrix sweep.
+  double crs_floor=0;
+
   for (;;) {
-    // Search for the largest peak. (Not the largest peak relative to
-    // the detection threshold Z_th1.)
-    ivec peak_ind_v;
-    vec peak_pow_v=max(transpose(xc_incoherent_working),peak_ind_v);
-    int32 peak_n_id_2;
-    double peak_pow=max(peak_pow_v,peak_n_id_2);
-    int32 peak_ind=peak_ind_v(peak_n_id_2);
+    if (heap.empty()) {
+      break;
+    }
+    const double heap_pow=heap.top().first;
+    const uint32 heap_idx=heap.top().second;
+    heap.pop();
+    int32 peak_n_id_2=heap_idx/9600;
+    int32 peak_ind=heap_idx%9600;
+    double & working=xc_incoherent_working(peak_n_id_2,peak_ind);
+    if (working<=0) {
+      // Cancelled by the neighborhood masking of an earlier peak.
+      continue;
+    }
+    if (working<crs_floor) {
+      working=0;
+      continue;
+    }
+    if (heap_pow!=working) {
+      // Stale entry; reinsert at the current power.
+      heap.push(make_pair(working,heap_idx));
+      continue;
+    }
+    // This entry is the true maximum of the working matrix. (Not the
+    // largest peak relative to the detection threshold Z_th1.)
+    const double peak_pow=heap_pow;
     if (peak_pow<Z_th1(peak_ind)) {
       // This peak has too low of a received power. There are no more
       // interesting peaks. Break!
@@ -497,15 +845,8 @@ void peak_search(
     }
     // Because of the repetitive nature of the CRS, a PSS at offset I with power
     // P will produce correlation peaks during all CRS OFDM symbols with power
-    // approximately P-14dB. Cancel them out.
-    thresh=peak_pow*udb10(-12.0);
-    for (uint8 r=0;r<3;r++) {
-      for (uint16 c=0;c<9600;c++) {
-        if (xc_incoherent_working(r,c)<thresh) {
-          xc_incoherent_working(r,c)=0;
-        }
-      }
-    }
+    // approximately P-14dB. Cancel them out (lazily, at pop time).
+    crs_floor=MAX(crs_floor,peak_pow*udb10(-12.0));
   }
 }
 
@@ -524,7 +865,7 @@ inline cvec extract_psss(
   // Remove the 2 sample time offset
   dft_in=concat(dft_in(2,-1),dft_in.left(2));
   // DFT
-  cvec dft_out=dft(dft_in);
+  cvec dft_out=dft_cached(dft_in);
   // Extract interesting samples.
   return concat(dft_out.right(31),dft_out.mid(1,31));
 }
@@ -636,9 +977,9 @@ void sss_detect_getce_sss(
 double sss_detect_ml_helper(
   const vec & sss_h12_np_est,
   const cvec & sss_h12_est,
-  const ivec & sss_h12_try_orig
+  const cvec & sss_h12_try_orig
 ) {
-  cvec sss_h12_try(to_cvec(sss_h12_try_orig));
+  cvec sss_h12_try(sss_h12_try_orig);
 
   // Compensate for phase errors between the est and try sequences
   double ang=arg(sum(elem_mult(conj(sss_h12_est),sss_h12_try)));
@@ -675,13 +1016,20 @@ void sss_detect_ml(
   vec sss_h12_np_est=concat(sss_h1_np_est,sss_h2_np_est);
   cvec sss_h12_nrm_est=concat(sss_h1_nrm_est,sss_h2_nrm_est);
   cvec sss_h12_ext_est=concat(sss_h1_ext_est,sss_h2_ext_est);
-  for (uint8 t=0;t<168;t++) {
+  // The 168 N_id_1 hypotheses are independent of each other and each
+  // one writes only its own rows of the log likelihood matrices.
+  uint8 t;
+#ifdef _OPENMP
+#pragma omp parallel for shared(log_lik_nrm,log_lik_ext,sss_h12_np_est,sss_h12_nrm_est,sss_h12_ext_est) private(t)
+#endif
+  for (t=0;t<168;t++) {
     // Construct the SSS sequence that will be compared against the
-    // received sequence.
-    ivec sss_h1_try=ROM_TABLES.sss_fd(t,cell.n_id_2,0);
-    ivec sss_h2_try=ROM_TABLES.sss_fd(t,cell.n_id_2,10);
-    ivec sss_h12_try=concat(sss_h1_try,sss_h2_try);
-    ivec sss_h21_try=concat(sss_h2_try,sss_h1_try);
+    // received sequence. Both table rows are fetched once and
+    // converted to complex once; the two orderings reuse them.
+    const cvec sss_h1_try=to_cvec(ROM_TABLES.sss_fd(t,cell.n_id_2,0));
+    const cvec sss_h2_try=to_cvec(ROM_TABLES.sss_fd(t,cell.n_id_2,10));
+    const cvec sss_h12_try=concat(sss_h1_try,sss_h2_try);
+    const cvec sss_h21_try=concat(sss_h2_try,sss_h1_try);
 
     // Calculate log likelihood for normal/extended and 12/21 ordering
     // of SSS sequence.
@@ -901,7 +1249,7 @@ void extract_tfg(
 #endif
   uint16 sym_num=0;
   for (uint16 t=0;t<n_ofdm_sym;t++) {
-    cvec dft_out=dft(capbuf.mid(round_i(dft_location),128));
+    cvec dft_out=dft_cached(capbuf.mid(round_i(dft_location),128));
     tfg.set_row(t,concat(dft_out.right(36),dft_out.mid(1,36)));
     // Record the time offset where the DFT _should_ have been taken.
     // It was actually taken at the nearest sample boundary.
@@ -1290,26 +1638,19 @@ void ce_interp_hex(
       // Calculate the parameters of a plane passing through all points
       // of the triangle.
       // value=a_p*x_sc+b_p*y_symnum+c_p;
-      cmat M(3,3);
-      M(0,0)=triangle[0].x_sc;
-      M(1,0)=triangle[1].x_sc;
-      M(2,0)=triangle[2].x_sc;
-      M(0,1)=triangle[0].y_symnum;
-      M(1,1)=triangle[1].y_symnum;
-      M(2,1)=triangle[2].y_symnum;
-      M(0,2)=1;
-      M(1,2)=1;
-      M(2,2)=1;
-      cvec V(3);
-      V(0)=triangle[0].val;
-      V(1)=triangle[1].val;
-      V(2)=triangle[2].val;
-      // In the future, inv(M) can be calculated directly for speed
-      // since the last column of M is all ones.
-      cvec abc=inv(M)*V;
-      complex <double> a_p=abc(0);
-      complex <double> b_p=abc(1);
-      complex <double> c_p=abc(2);
+      // Since the third unknown always has a coefficient of one, the
+      // system can be solved directly with Cramer's rule instead of the
+      // general 3x3 matrix inversion this used to perform per triangle.
+      const double dx0=triangle[0].x_sc-triangle[2].x_sc;
+      const double dx1=triangle[1].x_sc-triangle[2].x_sc;
+      const double dy0=(double)triangle[0].y_symnum-triangle[2].y_symnum;
+      const double dy1=(double)triangle[1].y_symnum-triangle[2].y_symnum;
+      const complex <double> dv0=triangle[0].val-triangle[2].val;
+      const complex <double> dv1=triangle[1].val-triangle[2].val;
+      const double det=dx0*dy1-dx1*dy0;
+      complex <double> a_p=(dv0*dy1-dv1*dy0)/det;
+      complex <double> b_p=(dx0*dv1-dx1*dv0)/det;
+      complex <double> c_p=triangle[2].val-a_p*(double)triangle[2].x_sc-b_p*(double)triangle[2].y_symnum;
 
       // Calculate the parameters of the line defining the rightmost
       // edge of the triangle.
@@ -1407,12 +1748,14 @@ void chan_est(
       shift(t)=rs_dl.get_shift(mod(slot_num,20),sym_num,port);
     }
 
-    cvec rs=rs_dl.get_rs(slot_num,sym_num);
-    // Extract
-    cvec raw_row=tfg.get_row(rs_set(t)).get(itpp_ext::matlab_range((int32)rs_dl.get_shift(mod(slot_num,20),sym_num,port),6,71));
-    ce_raw.set_row(t,raw_row);
-    // Compensate for known RS
-    ce_raw.set_row(t,elem_mult(ce_raw.get_row(t),conj(rs)));
+    const cvec & rs=rs_dl.get_rs(slot_num,sym_num);
+    const uint8 sh=rs_dl.get_shift(mod(slot_num,20),sym_num,port);
+    // Extract and compensate for the known RS in a single pass. The RS
+    // are every 6th subcarrier starting at the shift, so this avoids
+    // materializing an index vector and two row temporaries per symbol.
+    for (uint8 k=0;k<12;k++) {
+      ce_raw(t,k)=tfg(rs_set(t),sh+6*k)*conj(rs(k));
+    }
     if (((t&1)==1)||(port>=2)) {
       slot_num=mod(slot_num+1,20);
     }
@@ -1434,32 +1777,41 @@ void chan_est(
     complex <double> total;
     uint8 n_total;
     for (uint16 k=0;k<12;k++) {
-      // Current time offset
-      ivec ind;
-      ind=itpp_ext::matlab_range(k-1,k+1);
-      del_oob(ind);
-      total=sum(ce_raw.get_row(t).get(ind));
-      n_total=length(ind);
+      // Current time offset. The index ranges below are the clipped
+      // equivalents of the matlab_range/del_oob index vectors that used
+      // to be allocated for every single estimate.
+      const uint8 lt=(k==0)?0:k-1;
+      const uint8 rt=(k==11)?11:k+1;
+      total=0;
+      for (uint8 m=lt;m<=rt;m++) {
+        total+=ce_raw(t,m);
+      }
+      n_total=rt-lt+1;
 
       // Add in the previous and next time offset (if they exist)
-      if (shift(0)==shift(1)) {
-        ind=itpp_ext::matlab_range(k-1,k+1);
-      } else {
+      int8 lt2=k-1;
+      int8 rt2=k+1;
+      if (shift(0)!=shift(1)) {
         if (current_row_leftmost) {
-          ind=itpp_ext::matlab_range(k-1,k);
+          rt2=k;
         } else {
-          ind=itpp_ext::matlab_range(k,k+1);
+          lt2=k;
         }
       }
-      del_oob(ind);
+      if (lt2<0) lt2=0;
+      if (rt2>11) rt2=11;
       // Previous time offset
       if (t!=0) {
-        total+=sum(ce_raw.get_row(t-1).get(ind));
-        n_total+=length(ind);
+        for (uint8 m=lt2;m<=rt2;m++) {
+          total+=ce_raw(t-1,m);
+        }
+        n_total+=rt2-lt2+1;
       }
       if (t!=n_rs_ofdm-1) {
-        total+=sum(ce_raw.get_row(t+1).get(ind));
-        n_total+=length(ind);
+        for (uint8 m=lt2;m<=rt2;m++) {
+          total+=ce_raw(t+1,m);
+        }
+        n_total+=rt2-lt2+1;
       }
       ce_filt(t,k)=total/n_total;
     }
@@ -1537,14 +1889,24 @@ Cell decode_mib(
   // and for every RE, not only the RE's that contain an MIB!!!
   Array <cmat> ce_tfg(4);
   vec np_v(4);
-  chan_est(cell,rs_dl,tfg,0,ce_tfg(0),np_v(0));
-  chan_est(cell,rs_dl,tfg,1,ce_tfg(1),np_v(1));
-  chan_est(cell,rs_dl,tfg,2,ce_tfg(2),np_v(2));
-  chan_est(cell,rs_dl,tfg,3,ce_tfg(3),np_v(3));
-
-  // Try various frame offsets and number of TX antennas.
-  bvec c_est;
-  for (uint8 frame_timing_guess=0;frame_timing_guess<=3;frame_timing_guess++) {
+  uint8 port;
+#ifdef _OPENMP
+#pragma omp parallel for shared(ce_tfg,np_v) private(port)
+#endif
+  for (port=0;port<4;port++) {
+    chan_est(cell,rs_dl,tfg,port,ce_tfg(port),np_v(port));
+  }
+
+  // Extract the PBCH symbols and channel estimates once for each of the
+  // four possible 40ms frame alignments. This work is shared by the
+  // three antenna configurations tried for each alignment.
+  Array <cvec> pbch_sym_try(4);
+  Array <cmat> pbch_ce_try(4);
+  uint8 frame_timing_guess;
+#ifdef _OPENMP
+#pragma omp parallel for shared(ce_tfg,pbch_sym_try,pbch_ce_try) private(frame_timing_guess)
+#endif
+  for (frame_timing_guess=0;frame_timing_guess<=3;frame_timing_guess++) {
     const uint16 ofdm_sym_set_start=frame_timing_guess*10*2*n_symb_dl;
     ivec ofdm_sym_set=itpp_ext::matlab_range(ofdm_sym_set_start,ofdm_sym_set_start+3*10*2*n_symb_dl+2*n_symb_dl-1);
 
@@ -1557,135 +1919,170 @@ Cell decode_mib(
     }
 
     // Extract symbols and channel estimates for the PBCH
-    cvec pbch_sym;
-    cmat pbch_ce;
-    pbch_extract(cell,tfg_try,ce_try,pbch_sym,pbch_ce);
+    pbch_extract(cell,tfg_try,ce_try,pbch_sym_try(frame_timing_guess),pbch_ce_try(frame_timing_guess));
+  }
 
-    // Try 1, 2, and 4 ports.
+  // The 12 (frame alignment, n_ports) hypotheses are completely
+  // independent and each one requires a full deratematch/ Viterbi pass,
+  // so they are evaluated in parallel. Each hypothesis writes only its
+  // own element of c_est_try/ crc_pass. As soon as one hypothesis has
+  // passed the CRC, hypotheses that have not yet started exit
+  // immediately; a stale read of mib_found merely performs work that is
+  // then discarded.
+  Array <bvec> c_est_try(12);
+  ivec crc_pass(12);
+  crc_pass=0;
+  std::atomic <bool> mib_found(false);
+  uint8 h;
+#ifdef _OPENMP
+#pragma omp parallel for shared(np_v,pbch_sym_try,pbch_ce_try,c_est_try,crc_pass,mib_found) private(h)
+#endif
+  for (h=0;h<12;h++) {
+    if (mib_found.load(std::memory_order_relaxed))
+      continue;
+
+    // Hypotheses are ordered the same way the old serial search was:
+    // three antenna configurations tried for each frame alignment.
+    const uint8 ftg=h/3;
+    const uint8 n_ports_pre=h-ftg*3+1;
+    const uint8 n_ports=(n_ports_pre==3)?4:n_ports_pre;
+    const cvec & pbch_sym=pbch_sym_try(ftg);
+    const cmat & pbch_ce=pbch_ce_try(ftg);
+
+    // Perform channel compensation and also estimate noise power in each
+    // symbol.
     vec np;
     cvec syms;
-    for (uint8 n_ports_pre=1;n_ports_pre<=3;n_ports_pre++) {
-      const uint8 n_ports=(n_ports_pre==3)?4:n_ports_pre;
-      // Perform channel compensation and also estimate noise power in each
-      // symbol.
-      if (n_ports==1) {
-        cvec gain=conj(elem_div(pbch_ce.get_row(0),to_cvec(sqr(pbch_ce.get_row(0)))));
-        syms=elem_mult(pbch_sym,gain);
-        np=np_v(0)*sqr(gain);
-      } else {
-        syms.set_size(length(pbch_sym));
-        np.set_size(length(pbch_sym));
+    if (n_ports==1) {
+      cvec gain=conj(elem_div(pbch_ce.get_row(0),to_cvec(sqr(pbch_ce.get_row(0)))));
+      syms=elem_mult(pbch_sym,gain);
+      np=np_v(0)*sqr(gain);
+    } else {
+      syms.set_size(length(pbch_sym));
+      np.set_size(length(pbch_sym));
 #ifndef NDEBUG
-        syms=NAN;
-        np=NAN;
+      syms=NAN;
+      np=NAN;
 #endif
-        for (int32 t=0;t<length(syms);t+=2) {
-          // Simple zero-forcing
-          // http://en.wikipedia.org/wiki/Space-time_block_coding_based_transmit_diversity
-          complex <double> h1,h2;
-          double np_temp;
-          if (n_ports==2) {
+      for (int32 t=0;t<length(syms);t+=2) {
+        // Simple zero-forcing
+        // http://en.wikipedia.org/wiki/Space-time_block_coding_based_transmit_diversity
+        complex <double> h1,h2;
+        double np_temp;
+        if (n_ports==2) {
+          h1=(pbch_ce(0,t)+pbch_ce(0,t+1))/2;
+          h2=(pbch_ce(1,t)+pbch_ce(1,t+1))/2;
+          np_temp=mean(np_v(0,1));
+        } else {
+          if (mod(t,4)==0) {
             h1=(pbch_ce(0,t)+pbch_ce(0,t+1))/2;
-            h2=(pbch_ce(1,t)+pbch_ce(1,t+1))/2;
-            np_temp=mean(np_v(0,1));
+            h2=(pbch_ce(2,t)+pbch_ce(2,t+1))/2;
+            np_temp=(np_v(0)+np_v(2))/2;
           } else {
-            if (mod(t,4)==0) {
-              h1=(pbch_ce(0,t)+pbch_ce(0,t+1))/2;
-              h2=(pbch_ce(2,t)+pbch_ce(2,t+1))/2;
-              np_temp=(np_v(0)+np_v(2))/2;
-            } else {
-              h1=(pbch_ce(1,t)+pbch_ce(1,t+1))/2;
-              h2=(pbch_ce(3,t)+pbch_ce(3,t+1))/2;
-              np_temp=(np_v(1)+np_v(3))/2;
-            }
+            h1=(pbch_ce(1,t)+pbch_ce(1,t+1))/2;
+            h2=(pbch_ce(3,t)+pbch_ce(3,t+1))/2;
+            np_temp=(np_v(1)+np_v(3))/2;
           }
-          complex <double> x1=pbch_sym(t);
-          complex <double> x2=pbch_sym(t+1);
-          double scale=pow(h1.real(),2)+pow(h1.imag(),2)+pow(h2.real(),2)+pow(h2.imag(),2);
-          syms(t)=(conj(h1)*x1+h2*conj(x2))/scale;
-          syms(t+1)=conj((-conj(h2)*x1+h1*conj(x2))/scale);
-          np(t)=(pow(abs(h1)/scale,2)+pow(abs(h2)/scale,2))*np_temp;
-          np(t+1)=np(t);
         }
-        // 3dB factor comes from precoding for transmit diversity
-        syms=syms*pow(2,0.5);
+        complex <double> x1=pbch_sym(t);
+        complex <double> x2=pbch_sym(t+1);
+        double scale=pow(h1.real(),2)+pow(h1.imag(),2)+pow(h2.real(),2)+pow(h2.imag(),2);
+        syms(t)=(conj(h1)*x1+h2*conj(x2))/scale;
+        syms(t+1)=conj((-conj(h2)*x1+h1*conj(x2))/scale);
+        np(t)=(pow(abs(h1)/scale,2)+pow(abs(h2)/scale,2))*np_temp;
+        np(t+1)=np(t);
       }
+      // 3dB factor comes from precoding for transmit diversity
+      syms=syms*pow(2,0.5);
+    }
 
-      // Extract the bits from the complex modulated symbols.
-      vec e_est=lte_demodulate(syms,np,modulation_t::QAM);
-      // Unscramble
-      bvec scr=lte_pn(cell.n_id_cell(),length(e_est));
-      for (int32 t=0;t<length(e_est);t++) {
-        if (scr(t)) e_est(t)=-e_est(t);
-      }
-      // Undo ratematching
-      mat d_est=lte_conv_deratematch(e_est,40);
-      // Decode
-      c_est=lte_conv_decode(d_est);
-      // Calculate received CRC
-      bvec crc_est=lte_calc_crc(c_est(0,23),CRC16);
-      // Apply CRC mask
-      if (n_ports==2) {
-        for (uint8 t=0;t<16;t++) {
-          crc_est(t)=1-((int)crc_est(t));
-        }
-      } else if (n_ports==4) {
-        for (uint8 t=1;t<length(crc_est);t+=2) {
-          crc_est(t)=1-((int)crc_est(t));
-        }
+    // Extract the bits from the complex modulated symbols.
+    vec e_est=lte_demodulate(syms,np,modulation_t::QAM);
+    // Unscramble
+    bvec scr=lte_pn(cell.n_id_cell(),length(e_est));
+    for (int32 t=0;t<length(e_est);t++) {
+      if (scr(t)) e_est(t)=-e_est(t);
+    }
+    // Undo ratematching
+    mat d_est=lte_conv_deratematch(e_est,40);
+    // Decode
+    bvec c_est=lte_conv_decode(d_est);
+    // Calculate received CRC
+    bvec crc_est=lte_calc_crc(c_est(0,23),CRC16);
+    // Apply CRC mask
+    if (n_ports==2) {
+      for (uint8 t=0;t<16;t++) {
+        crc_est(t)=1-((int)crc_est(t));
       }
-      // Did we find it?
-      if (crc_est==c_est(24,-1)) {
-        // YES!
-        cell_out.n_ports=n_ports;
-        // Unpack the MIB
-        ivec c_est_ivec=to_ivec(c_est);
-        // DL bandwidth
-        const uint8 bw_packed=c_est_ivec(0)*4+c_est_ivec(1)*2+c_est_ivec(2);
-        switch (bw_packed) {
-          case 0:
-            cell_out.n_rb_dl=6;
-            break;
-          case 1:
-            cell_out.n_rb_dl=15;
-            break;
-          case 2:
-            cell_out.n_rb_dl=25;
-            break;
-          case 3:
-            cell_out.n_rb_dl=50;
-            break;
-          case 4:
-            cell_out.n_rb_dl=75;
-            break;
-          case 5:
-            cell_out.n_rb_dl=100;
-            break;
-        }
-        // PHICH duration
-        cell_out.phich_duration=c_est_ivec(3)?phich_duration_t::EXTENDED:phich_duration_t::NORMAL;
-        // PHICH resources
-        uint8 phich_res=c_est_ivec(4)*2+c_est_ivec(5);
-        switch (phich_res) {
-          case 0:
-            cell_out.phich_resource=phich_resource_t::oneSixth;
-            break;
-          case 1:
-            cell_out.phich_resource=phich_resource_t::half;
-            break;
-          case 2:
-            cell_out.phich_resource=phich_resource_t::one;
-            break;
-          case 3:
-            cell_out.phich_resource=phich_resource_t::two;
-            break;
-        }
-        // Calculate SFN
-        int8 sfn_temp=128*c_est_ivec(6)+64*c_est_ivec(7)+32*c_est_ivec(8)+16*c_est_ivec(9)+8*c_est_ivec(10)+4*c_est_ivec(11)+2*c_est_ivec(12)+c_est_ivec(13);
-        cell_out.sfn=itpp_ext::matlab_mod(sfn_temp*4-frame_timing_guess,1024);
-        return cell_out;
+    } else if (n_ports==4) {
+      for (uint8 t=1;t<length(crc_est);t+=2) {
+        crc_est(t)=1-((int)crc_est(t));
       }
     }
+    // Did we find it?
+    if (crc_est==c_est(24,-1)) {
+      // YES!
+      c_est_try(h)=c_est;
+      crc_pass(h)=1;
+      mib_found.store(true,std::memory_order_relaxed);
+    }
+  }
+
+  // Use the first hypothesis, in the original serial search order, that
+  // passed the CRC.
+  for (h=0;h<12;h++) {
+    if (!crc_pass(h))
+      continue;
+
+    const uint8 ftg=h/3;
+    const uint8 n_ports_pre=h-ftg*3+1;
+    cell_out.n_ports=(n_ports_pre==3)?4:n_ports_pre;
+    // Unpack the MIB
+    ivec c_est_ivec=to_ivec(c_est_try(h));
+    // DL bandwidth
+    const uint8 bw_packed=c_est_ivec(0)*4+c_est_ivec(1)*2+c_est_ivec(2);
+    switch (bw_packed) {
+      case 0:
+        cell_out.n_rb_dl=6;
+        break;
+      case 1:
+        cell_out.n_rb_dl=15;
+        break;
+      case 2:
+        cell_out.n_rb_dl=25;
+        break;
+      case 3:
+        cell_out.n_rb_dl=50;
+        break;
+      case 4:
+        cell_out.n_rb_dl=75;
+        break;
+      case 5:
+        cell_out.n_rb_dl=100;
+        break;
+    }
+    // PHICH duration
+    cell_out.phich_duration=c_est_ivec(3)?phich_duration_t::EXTENDED:phich_duration_t::NORMAL;
+    // PHICH resources
+    uint8 phich_res=c_est_ivec(4)*2+c_est_ivec(5);
+    switch (phich_res) {
+      case 0:
+        cell_out.phich_resource=phich_resource_t::oneSixth;
+        break;
+      case 1:
+        cell_out.phich_resource=phich_resource_t::half;
+        break;
+      case 2:
+        cell_out.phich_resource=phich_resource_t::one;
+        break;
+      case 3:
+        cell_out.phich_resource=phich_resource_t::two;
+        break;
+    }
+    // Calculate SFN
+    int8 sfn_temp=128*c_est_ivec(6)+64*c_est_ivec(7)+32*c_est_ivec(8)+16*c_est_ivec(9)+8*c_est_ivec(10)+4*c_est_ivec(11)+2*c_est_ivec(12)+c_est_ivec(13);
+    cell_out.sfn=itpp_ext::matlab_mod(sfn_temp*4-ftg,1024);
+    return cell_out;
   }
 
   return cell_out;
@@ -49,6 +49,33 @@ using namespace std;
 
 #define DS_COMB_ARM 2
 
+// Sleep after a work quantum of 'busy_time' seconds so that the
+// searcher's CPU usage averages out to the requested duty cycle. The
+// pacing only kicks in while cells are actually being tracked: finding
+// a new cell a few times slower is preferable to dropping samples on
+// cells that are already locked, but with nothing to protect, the
+// searcher might as well run flat out.
+static void searcher_pace(
+  const double & busy_time,
+  global_thread_data_t & global_thread_data,
+  tracked_cell_list_t & tracked_cell_list
+) {
+  const double duty=global_thread_data.searcher_duty_cycle();
+  if ((duty>=1.0)||(busy_time<=0)) {
+    return;
+  }
+  {
+    boost::mutex::scoped_lock lock(tracked_cell_list.mutex);
+    if (tracked_cell_list.tracked_cells.empty()) {
+      return;
+    }
+  }
+  double idle_time=busy_time*(1.0-duty)/duty;
+  // Do not let one long quantum idle the searcher for ages.
+  idle_time=MIN(idle_time,5.0);
+  boost::this_thread::sleep(boost::posix_time::milliseconds(round_i(idle_time*1000)));
+}
+
 // This is the searcher process. It requests captured data from the main
 // thread and launches a new thread for every cell it finds. Each new
 // cell thread then requests sample data from the main thread.
@@ -93,6 +120,11 @@ void searcher_thread(
       capbuf_sync.condition.wait(lock);
     }
 
+    // Measures the CPU-heavy work quanta (the capture wait above is not
+    // busy time).
+    Real_Timer quantum_timer;
+    quantum_timer.tic();
+
     // Get the current frequency offset
     vec f_search_set(1);
     f_search_set(0)=global_thread_data.frequency_offset();
@@ -131,9 +163,17 @@ void searcher_thread(
     }
     peak_search(xc_incoherent_collapsed_pow,xc_incoherent_collapsed_frq,Z_th1,f_search_set,fc_requested,fc_programmed,xc_incoherent_single,DS_COMB_ARM,detected_cells);
 
+    // The correlation burst is the searcher's biggest single quantum.
+    searcher_pace(quantum_timer.toc(),global_thread_data,tracked_cell_list);
+
     // Loop and check each peak
     list<Cell>::iterator iterator=detected_cells.begin();
+    quantum_timer.tic();
     while (iterator!=detected_cells.end()) {
+      // Pace based on however long the previous peak took to examine.
+      searcher_pace(quantum_timer.toc(),global_thread_data,tracked_cell_list);
+      quantum_timer.tic();
+
       // Detect SSS if possible
       vec sss_h1_np_est_meas;
       vec sss_h2_np_est_meas;
@@ -225,8 +265,8 @@ void searcher_thread(
         serial_num((*iterator).n_id_cell())
       );
       serial_num((*iterator).n_id_cell())++;
-      // Cannot launch thread here. If thread was launched here, it would
-      // have the same (low) priority as the searcher thread.
+      // The producer thread hands the new cell to the tracker worker
+      // pool once it sees it on this list.
       {
         boost::mutex::scoped_lock lock(tracked_cell_list.mutex);
         tracked_cell_list.tracked_cells.push_back(new_cell);
@@ -242,7 +282,9 @@ void searcher_thread(
 
       ++iterator;
     }
-    global_thread_data.searcher_cycle_time(tt.toc());
+    const double cycle_time=tt.toc();
+    global_thread_data.searcher_cycle_time(cycle_time);
+    global_thread_data.searcher_cycle_hist.record(cycle_time);
   }
   // Will never reach here...
 }
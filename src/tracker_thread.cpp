@@ -79,6 +79,39 @@ typedef struct {
   double np;
   cvec ce_interp;
 } ce_interp_fifo_pdu_t;
+// Interpolated CE fifo with a recycling pool. One of these PDUs is
+// produced and consumed for every OFDM symbol of every port of every
+// tracked cell, so PDUs circulate by pointer and consumed PDUs go back
+// to 'pool' so that their cvec storage is reused instead of being
+// reallocated at every push. Only the worker currently servicing the
+// cell touches this, so no lock is needed.
+typedef struct {
+  deque <ce_interp_fifo_pdu_t *> fifo;
+  vector <ce_interp_fifo_pdu_t *> pool;
+} ce_interp_fifo_t;
+
+// Take a recycled PDU from the pool, or allocate one while the pool is
+// still being populated.
+static ce_interp_fifo_pdu_t * ce_interp_pdu_acquire(
+  ce_interp_fifo_t & f
+) {
+  if (f.pool.empty()) {
+    ce_interp_fifo_pdu_t * pdu=new ce_interp_fifo_pdu_t;
+    pdu->ce_interp.set_size(72);
+    return pdu;
+  }
+  ce_interp_fifo_pdu_t * pdu=f.pool.back();
+  f.pool.pop_back();
+  return pdu;
+}
+
+// Return a consumed PDU (and its storage) to the pool.
+static inline void ce_interp_pdu_release(
+  ce_interp_fifo_t & f,
+  ce_interp_fifo_pdu_t * pdu
+) {
+  f.pool.push_back(pdu);
+}
 typedef struct {
   cvec syms;
   cmat ce;
@@ -86,41 +119,23 @@ typedef struct {
   vec np;
 } mib_fifo_pdu_t;
 
-// Pop 128 time domain samples from the fifo, convert to the frequency
-// domain, and extract the 72 desired subcarriers.
+// Convert 128 time domain samples to the frequency domain and extract the
+// 72 desired subcarriers. The PDU has already been popped from the fifo by
+// the calling worker; ownership passes to this function and the PDU is
+// recycled before returning.
 void get_fd(
   tracked_cell_t & tracked_cell,
   const double & fc_requested,
   const double & fc_programmed,
   const double & fs_programmed,
-  const uint8 & slot_num,
-  const uint8 & sym_num,
+  td_fifo_pdu_t * pdu_p,
   //const ivec & cn,
   double & bulk_phase_offset,
   cvec & syms,
   double & frequency_offset,
   double & frame_timing
 ) {
-  td_fifo_pdu_t pdu;
-  {
-    // Lock the fifo until we obtain one element.
-    boost::mutex::scoped_lock lock(tracked_cell.fifo_mutex);
-    if (tracked_cell.fifo.empty()) {
-      tracked_cell.fifo_condition.wait(lock);
-    }
-    ASSERT(!tracked_cell.fifo.empty());
-#ifndef NDEBUG
-    if ((tracked_cell.fifo.front().slot_num!=slot_num)||(tracked_cell.fifo.front().sym_num!=sym_num)) {
-      // We should never get here...
-      cerr << "Error: cell tracker synchronization error! Check code!" << endl;
-      ABORT(-1);
-    }
-#endif
-    // Copy locally
-    pdu=tracked_cell.fifo.front();
-    // POP the fifo
-    tracked_cell.fifo.pop();
-  }
+  td_fifo_pdu_t & pdu=*pdu_p;
 
   // Convert to frequency domain and extract 6 center RB's.
   // Also perform FOC to remove ICI
@@ -139,7 +154,7 @@ void get_fd(
   }
   dft_in(126)=pdu.data.get(0);
   dft_in(127)=pdu.data.get(1);
-  cvec dft_out=dft(dft_in);
+  cvec dft_out=dft_cached(dft_in);
   //syms=concat(dft_out.right(36),dft_out.mid(1,36));
   syms.set_size(72);
   for (uint8 t=0;t<36;t++) {
@@ -153,7 +168,7 @@ void get_fd(
   if (tracked_cell.cp_type==cp_type_t::EXTENDED) {
     n_samp_elapsed=128+32;
   } else {
-    n_samp_elapsed=(sym_num==0)?128+10:128+9;
+    n_samp_elapsed=(pdu.sym_num==0)?128+10:128+9;
   }
   //syms=exp(J*bulk_phase_offset)*elem_mult(syms,exp((-J*2*pi*tracked_cell.fifo.front().late/128)*cn));
   complex <double> coeff;
@@ -171,6 +186,9 @@ void get_fd(
   }
   // At this point, we have the frequency domain data for this slot and
   // this symbol number. FOC and TOC has already been performed.
+
+  // Recycle the PDU storage.
+  tracked_cell.pdu_release(pdu_p);
 }
 
 cvec filter_ce(
@@ -333,10 +351,7 @@ void do_ac_fd(
   //ac_fd=ac_fd/ac_fd(0);
   ac_fd=ac_fd/rs_curr_sp;
   vec ac_fd_np=(rs_curr_np*rs_curr_np/(rs_curr_sp*rs_curr_sp)+2*rs_curr_np/rs_curr_sp)/itpp_ext::matlab_range(12.0,-1.0,1.0);
-  {
-    boost::mutex::scoped_lock lock(tracked_cell.meas_mutex);
-    tracked_cell.ac_fd=elem_div(tracked_cell.ac_fd*(1/.00001)+elem_mult(ac_fd,to_cvec(1.0/ac_fd_np)),to_cvec(1/.00001+1.0/ac_fd_np));
-  }
+  tracked_cell.meas.ac_fd=elem_div(tracked_cell.meas.ac_fd*(1/.00001)+elem_mult(ac_fd,to_cvec(1.0/ac_fd_np)),to_cvec(1/.00001+1.0/ac_fd_np));
 }
 
 // Estimate the time domain autocorrelation function.
@@ -364,8 +379,7 @@ void do_ac_td(
     this_xc=this_xc/rs_curr_sp;
 
     // Update average
-    boost::mutex::scoped_lock lock(tracked_cell.meas_mutex);
-    tracked_cell.ac_td=(tracked_cell.ac_td*(1/.00001)+this_xc*1/1)/(1/.00001+1);
+    tracked_cell.meas.ac_td=(tracked_cell.meas.ac_td*(1/.00001)+this_xc*1/1)/(1/.00001+1);
   }
 }
 
@@ -397,13 +411,14 @@ void interp2d(
   const ce_filt_fifo_pdu_t & rs_prev,
   const ce_filt_fifo_pdu_t & rs_curr,
   const uint8 & port_num,
-  deque <ce_interp_fifo_pdu_t> & ce_interp_fifo,
+  cvec & rs_prev_interp,
+  cvec & rs_curr_interp,
+  ce_interp_fifo_t & ce_interp_fifo,
   uint8 & ce_interp_fifo_initialized
 ) {
-  // Interpolate in the frequency domain.
-  cvec rs_prev_interp;
+  // Interpolate in the frequency domain. The scratch vectors are owned
+  // by the caller and keep their storage from call to call.
   interp72(rs_prev,rs_prev_interp);
-  cvec rs_curr_interp;
   interp72(rs_curr,rs_curr_interp);
 
   // Interpolate in the time domain and push onto FIFO
@@ -428,20 +443,17 @@ void interp2d(
 
   double time_offset=0;
   while ((slot_num!=rs_curr.slot_num)||(sym_num!=rs_curr.sym_num)) {
-    // Interpolate in the time domain.
-    cvec rs_mid=rs_prev_interp+(rs_curr_interp-rs_prev_interp)*(time_offset/time_diff);
-    double rs_mid_tp=rs_prev.tp+(rs_curr.tp-rs_prev.tp)*(time_offset/time_diff);
-    double rs_mid_sp=rs_prev.sp+(rs_curr.sp-rs_prev.sp)*(time_offset/time_diff);
-    double rs_mid_sp_raw=rs_prev.sp_raw+(rs_curr.sp_raw-rs_prev.sp_raw)*(time_offset/time_diff);
-    double rs_mid_np=rs_prev.np+(rs_curr.np-rs_prev.np)*(time_offset/time_diff);
-
-    // Push onto the interpolated CE fifo.
-    ce_interp_fifo_pdu_t pdu;
-    pdu.ce_interp=rs_mid;
-    pdu.tp=rs_mid_tp;
-    pdu.sp=rs_mid_sp;
-    pdu.sp_raw=rs_mid_sp_raw;
-    pdu.np=rs_mid_np;
+    // Interpolate in the time domain, writing directly into a pooled
+    // PDU so that no intermediate vectors are created.
+    ce_interp_fifo_pdu_t * pdu=ce_interp_pdu_acquire(ce_interp_fifo);
+    const double w=time_offset/time_diff;
+    for (uint8 t=0;t<72;t++) {
+      pdu->ce_interp(t)=rs_prev_interp(t)+(rs_curr_interp(t)-rs_prev_interp(t))*w;
+    }
+    pdu->tp=rs_prev.tp+(rs_curr.tp-rs_prev.tp)*w;
+    pdu->sp=rs_prev.sp+(rs_curr.sp-rs_prev.sp)*w;
+    pdu->sp_raw=rs_prev.sp_raw+(rs_curr.sp_raw-rs_prev.sp_raw)*w;
+    pdu->np=rs_prev.np+(rs_curr.np-rs_prev.np)*w;
     if (!ce_interp_fifo_initialized) {
       // Repeat the very first channel estimates so as to provide CE for
       // slot 0 sym 0.
@@ -449,18 +461,24 @@ void interp2d(
       uint8 tsy=0;
       uint8 tsl=0;
       while ((tsy!=sym_num)||(tsl!=slot_num)) {
-        pdu.sym_num=tsy;
-        pdu.slot_num=tsl;
-        ce_interp_fifo.push_back(pdu);
+        ce_interp_fifo_pdu_t * pdu_pre=ce_interp_pdu_acquire(ce_interp_fifo);
+        pdu_pre->ce_interp=pdu->ce_interp;
+        pdu_pre->tp=pdu->tp;
+        pdu_pre->sp=pdu->sp;
+        pdu_pre->sp_raw=pdu->sp_raw;
+        pdu_pre->np=pdu->np;
+        pdu_pre->sym_num=tsy;
+        pdu_pre->slot_num=tsl;
+        ce_interp_fifo.fifo.push_back(pdu_pre);
         tsy=mod(tsy+1,tracked_cell.n_symb_dl());
         if (tsy==0) {
           tsl=mod(tsl+1,20);
         }
       }
     }
-    pdu.slot_num=slot_num;
-    pdu.sym_num=sym_num;
-    ce_interp_fifo.push_back(pdu);
+    pdu->slot_num=slot_num;
+    pdu->sym_num=sym_num;
+    ce_interp_fifo.fifo.push_back(pdu);
 
     // Increment counters.
     if (tracked_cell.cp_type==cp_type_t::EXTENDED) {
@@ -478,11 +496,11 @@ void interp2d(
 
 // Small helper function returns true if all the fifos contain data.
 bool ce_ready(
-  const vector <deque <ce_interp_fifo_pdu_t> > & ce_interp_fifo
+  const vector <ce_interp_fifo_t> & ce_interp_fifo
 ) {
   bool ready=true;
   for (uint8 t=0;t<ce_interp_fifo.size();t++) {
-    ready=ready&&(!ce_interp_fifo[t].empty());
+    ready=ready&&(!ce_interp_fifo[t].fifo.empty());
     if (!ready)
       break;
   }
@@ -707,27 +725,18 @@ int8 do_mib_decode(
       (phich_resource_est==tracked_cell.phich_resource)
     ) {
       mib_fifo_synchronized=1;
-      {
-        boost::mutex::scoped_lock lock(tracked_cell.meas_mutex);
-        tracked_cell.mib_decode_failures=0;
-      }
+      tracked_cell.meas.mib_decode_failures=0;
       for (uint8 t=0;t<16;t++) {
         mib_fifo.pop_front();
       }
     } else {
       if (mib_fifo_synchronized) {
-        {
-          boost::mutex::scoped_lock lock(tracked_cell.meas_mutex);
-          tracked_cell.mib_decode_failures++;
-        }
+        tracked_cell.meas.mib_decode_failures++;
         for (uint8 t=0;t<16;t++) {
           mib_fifo.pop_front();
         }
       } else {
-        {
-          boost::mutex::scoped_lock lock(tracked_cell.meas_mutex);
-          tracked_cell.mib_decode_failures+=0.25;
-        }
+        tracked_cell.meas.mib_decode_failures+=0.25;
         for (uint8 t=0;t<4;t++) {
           mib_fifo.pop_front();
         }
@@ -736,7 +745,7 @@ int8 do_mib_decode(
 
     // 10ms of time increases mib_fifo_decode_failures by 0.25.
     // After several seconds of MIB decoding failures, drop the cell.
-    if (tracked_cell.mib_decode_failures>=CELL_DROP_THRESHOLD) {
+    if (tracked_cell.meas.mib_decode_failures>=CELL_DROP_THRESHOLD) {
       //cout << "Dropped a cell!" << endl;
       //boost::mutex::scoped_lock lock(tracked_cell.mutex);
       tracked_cell.kill_me=true;
@@ -798,272 +807,384 @@ void do_pss_sss_sigpower_ce(
   double sp=tp-np/13;
 
   // Store results
-  {
-    boost::mutex::scoped_lock lock(tracked_cell.meas_mutex);
-    tracked_cell.sync_tp=tp;
-    tracked_cell.sync_sp=sp;
-    tracked_cell.sync_np=np;
-    tracked_cell.sync_np_blank=np_blank;
-    tracked_cell.sync_ce=concat(zeros_c(5),ce_smooth,zeros_c(5));
-    if (isnan(tracked_cell.sync_sp_av)) {
-      tracked_cell.sync_tp_av=tp;
-      tracked_cell.sync_sp_av=sp;
-      tracked_cell.sync_np_av=np;
-      tracked_cell.sync_np_blank_av=np_blank;
-    } else {
-      tracked_cell.sync_tp_av=0.999*tracked_cell.sync_tp_av+.001*tp;
-      tracked_cell.sync_sp_av=0.999*tracked_cell.sync_sp_av+.001*sp;
-      tracked_cell.sync_np_av=0.999*tracked_cell.sync_np_av+.001*np;
-      tracked_cell.sync_np_blank_av=0.999*tracked_cell.sync_np_blank_av+.001*np_blank;
-    }
+  tracked_cell.meas.sync_tp=tp;
+  tracked_cell.meas.sync_sp=sp;
+  tracked_cell.meas.sync_np=np;
+  tracked_cell.meas.sync_np_blank=np_blank;
+  tracked_cell.meas.sync_ce=concat(zeros_c(5),ce_smooth,zeros_c(5));
+  if (isnan(tracked_cell.meas.sync_sp_av)) {
+    tracked_cell.meas.sync_tp_av=tp;
+    tracked_cell.meas.sync_sp_av=sp;
+    tracked_cell.meas.sync_np_av=np;
+    tracked_cell.meas.sync_np_blank_av=np_blank;
+  } else {
+    tracked_cell.meas.sync_tp_av=0.999*tracked_cell.meas.sync_tp_av+.001*tp;
+    tracked_cell.meas.sync_sp_av=0.999*tracked_cell.meas.sync_sp_av+.001*sp;
+    tracked_cell.meas.sync_np_av=0.999*tracked_cell.meas.sync_np_av+.001*np;
+    tracked_cell.meas.sync_np_blank_av=0.999*tracked_cell.meas.sync_np_blank_av+.001*np_blank;
   }
 }
 
-// Process that tracks a cell that has been found by the searcher.
-void tracker_thread(
-  tracked_cell_t & tracked_cell,
-  global_thread_data_t & global_thread_data
-) {
-  // Pre-compute some information.
-  //ivec cn=concat(itpp_ext::matlab_range(-36,-1),itpp_ext::matlab_range(1,36));
+// All per-cell processing state that used to live on a dedicated tracker
+// thread's stack. The worker pool threads are interchangeable, so this
+// state now lives on the heap, attached to the cell it belongs to. It is
+// only ever touched by the single worker currently servicing the cell.
+struct tracker_cell_state_t {
+  tracker_cell_state_t(const tracked_cell_t & tracked_cell) :
+    rs_dl(tracked_cell.n_id_cell,6,tracked_cell.cp_type),
+    scr(lte_pn(tracked_cell.n_id_cell,(tracked_cell.cp_type==cp_type_t::NORMAL)?1920:1728)),
+    slot_num(0),
+    sym_num(0),
+    bulk_phase_offset(0),
+    ce_raw_fifo(tracked_cell.n_ports),
+    ce_filt_fifo(tracked_cell.n_ports),
+    ce_interp_fifo(tracked_cell.n_ports),
+    ce_interp_fifo_initialized(tracked_cell.n_ports,0),
+    mib_fifo_synchronized(false),
+    ce_history(tracked_cell.n_ports)
+  {}
+  ~tracker_cell_state_t(void) {
+    // Free the PDUs still in flight and the recycling pools.
+    for (uint8 t=0;t<ce_interp_fifo.size();t++) {
+      while (!ce_interp_fifo[t].fifo.empty()) {
+        delete ce_interp_fifo[t].fifo.front();
+        ce_interp_fifo[t].fifo.pop_front();
+      }
+      for (uint32 k=0;k<ce_interp_fifo[t].pool.size();k++) {
+        delete ce_interp_fifo[t].pool[k];
+      }
+    }
+  }
   // Reference symbols
-  RS_DL rs_dl(tracked_cell.n_id_cell,6,tracked_cell.cp_type);
+  RS_DL rs_dl;
   // MIB scrambling sequence.
-  const bvec scr=lte_pn(tracked_cell.n_id_cell,(tracked_cell.cp_type==cp_type_t::NORMAL)?1920:1728);
-
-  uint8 slot_num=0;
-  uint8 sym_num=0;
-  double bulk_phase_offset=0;
+  const bvec scr;
+  uint8 slot_num;
+  uint8 sym_num;
+  double bulk_phase_offset;
   deque <data_fifo_pdu_t> data_fifo;
-  vector <deque <ce_raw_fifo_pdu_t> > ce_raw_fifo(tracked_cell.n_ports);
-  vector <deque <ce_filt_fifo_pdu_t> > ce_filt_fifo(tracked_cell.n_ports);
-  vector <deque <ce_interp_fifo_pdu_t> > ce_interp_fifo(tracked_cell.n_ports);
+  vector <deque <ce_raw_fifo_pdu_t> > ce_raw_fifo;
+  vector <deque <ce_filt_fifo_pdu_t> > ce_filt_fifo;
+  vector <ce_interp_fifo_t> ce_interp_fifo;
   // Cannot use bool here because all the bits would be packed into bytes
   // and could not be passed by reference.
-  vector <uint8> ce_interp_fifo_initialized(tracked_cell.n_ports,0);
+  vector <uint8> ce_interp_fifo_initialized;
+  // Scratch storage for interp2d's frequency domain interpolation,
+  // reused from symbol to symbol.
+  cvec interp_scratch_prev;
+  cvec interp_scratch_curr;
   deque <mib_fifo_pdu_t> mib_fifo;
-  bool mib_fifo_synchronized=false;
+  bool mib_fifo_synchronized;
   cvec sss_sym;
-  //double mib_fifo_decode_failures=0;
   // Store the channel estimates so that the time domain channel
   // autocorrelation function can be estimated.
-  vector <deque <cvec> > ce_history(tracked_cell.n_ports);
-  // Now that everything has been initialized, indicate to the producer
-  // thread that we are ready for data.
-  // Data flow starts at the beginning of the next frame.
-  tracked_cell.tracker_thread_ready=true;
-  // Each iteration of this loop processes one OFDM symbol.
-  while (true) {
-    // If there is more than 1.5s worth of data in the fifo, dump
-    // data to allow the tracker threads to catch up.
-    {
-      boost::mutex::scoped_lock lock(tracked_cell.fifo_mutex);
-      uint16 n_ofdm_1s=(tracked_cell.cp_type==cp_type_t::NORMAL)?(7*2*1000):(6*2*1000);
-      while (tracked_cell.fifo.size()>n_ofdm_1s*1.5) {
-        for (uint32 t=0;t<n_ofdm_1s;t++) {
-          tracked_cell.fifo.pop();
-        }
-        global_thread_data.cell_seconds_dropped_inc();
-      }
-    }
+  vector <deque <cvec> > ce_history;
+};
 
-    // Get the next frequency domain sample from the fifo.
-    cvec syms;
-    double frequency_offset;
-    double frame_timing;
-    //get_fd(tracked_cell,global_thread_data.fc,slot_num,sym_num,cn,bulk_phase_offset,syms,frequency_offset,frame_timing);
-    get_fd(tracked_cell,global_thread_data.fc_requested,global_thread_data.fc_programmed,global_thread_data.fs_programmed,slot_num,sym_num,bulk_phase_offset,syms,frequency_offset,frame_timing);
-
-    // Save this information into the data fifo for further processing
-    // once channel estimates are ready. Channel estimates for this OFDM
-    // symbol may not be ready until several more OFDM symbols have been
-    // received.
-    data_fifo_pdu_t dfp;
-    dfp.slot_num=slot_num;
-    dfp.sym_num=sym_num;
-    dfp.syms=syms;
-    data_fifo.push_back(dfp);
-
-    // Extract any RS that might be present.
-    for (uint8 port_num=0;port_num<tracked_cell.n_ports;port_num++) {
-      double shift=rs_dl.get_shift(slot_num,sym_num,port_num);
-      if (isnan(shift))
-        continue;
-      //cout << "S" << shift << endl;
-      cvec rs_raw=syms(itpp_ext::matlab_range(round_i(shift),6,71));
-      //cout << "A" << rs_dl.get_rs(slot_num,sym_num) << endl;
-      //cout << slot_num << " x " << sym_num << endl;
-      //cout << "B" << rs_raw << endl;
-      cvec ce_raw=elem_mult(rs_raw,conj(rs_dl.get_rs(slot_num,sym_num)));
-      ce_raw_fifo_pdu_t cerp;
-      cerp.shift=shift;
-      cerp.slot_num=slot_num;
-      cerp.sym_num=sym_num;
-      cerp.ce=ce_raw;
-      cerp.frequency_offset=frequency_offset;
-      cerp.frame_timing=frame_timing;
-      ce_raw_fifo[port_num].push_back(cerp);
-    }
+// The state is an incomplete type outside of this translation unit, so the
+// cell destructor frees it through this helper.
+void tracker_state_free(tracker_cell_state_t * state) {
+  delete state;
+}
 
-    // For each port, filter and perform FOE, TOE, and interpolation on the raw
-    // channel estimates. Also perform some measurements.
-    // All tasks that need access to the raw channel estimates should
-    // go in this loop.
-    for (uint8 port_num=0;port_num<tracked_cell.n_ports;port_num++) {
-      // In order to filter the raw channel estimates for OFDM symbol n,
-      // we need the raw channel estimates for OFDM symbols n-1, n, and n+1.
-      if (ce_raw_fifo[port_num].size()!=3)
-        continue;
-
-      // Shortcuts
-      ce_raw_fifo_pdu_t & rs_prev=ce_raw_fifo[port_num][0];
-      ce_raw_fifo_pdu_t & rs_curr=ce_raw_fifo[port_num][1];
-      ce_raw_fifo_pdu_t & rs_next=ce_raw_fifo[port_num][2];
-
-      // Perform primitive filtering by averaging nearby samples.
-      const cvec rs_curr_filt=filter_ce(rs_prev,rs_curr,rs_next);
-      // Note correction for the estimation bias.
-      const double rs_curr_np=sigpower(rs_curr.ce-rs_curr_filt)*7/6;
-      //const double rs_curr_np=sigpower(rs_curr.ce-rs_curr_filt)*(1.0/(pow(2.0/7.0,2.0)*2.0+pow(3.0/7.0,2.0)*2.0/3.0));
-      // Note that this value can be negative!
-      //const double rs_curr_sp=MAX(sigpower(rs_curr_filt)-rs_curr_np/7,0);
-      const double rs_curr_tp=sigpower(rs_curr_filt);
-      const double rs_curr_sp_raw=rs_curr_tp-rs_curr_np/7;
-      const double rs_curr_sp=MAX(.00001,rs_curr_sp_raw);
-      //cout << "SP RSC " << db10(sigpower(rs_curr.ce)) << endl;
-      //cout << "SP/NP " << db10(rs_curr_sp) << " / " << db10(rs_curr_np) << endl;
-      // Store filtered channel estimates.
-      ce_filt_fifo_pdu_t pdu;
-      pdu.shift=rs_curr.shift;
-      pdu.slot_num=rs_curr.slot_num;
-      pdu.sym_num=rs_curr.sym_num;
-      pdu.tp=rs_curr_tp;
-      pdu.sp=rs_curr_sp;
-      pdu.sp_raw=rs_curr_sp_raw;
-      pdu.np=rs_curr_np;
-      pdu.ce_filt=rs_curr_filt;
-      ce_filt_fifo[port_num].push_back(pdu);
-
-      // FOE
-      do_foe(global_thread_data,rs_prev,rs_next,rs_curr_np,rs_curr_filt);
-
-      // TOE
-      //do_toe(tracked_cell,rs_curr,rs_curr_filt,rs_curr_np);
-      do_toe_v2(tracked_cell,rs_prev,rs_curr,rs_curr_sp,rs_curr_np);
-
-      // Estimate frequency domain autocorrelations.
-      do_ac_fd(tracked_cell,rs_curr,rs_curr_sp,rs_curr_np);
-
-      // Estimate the time domain autocorrelation function.
-      do_ac_td(tracked_cell,rs_curr,rs_curr_sp,ce_history[port_num]);
-
-      // Finished working with the raw channel estimates.
-      ce_raw_fifo[port_num].pop_front();
-    }
+// Process one OFDM symbol's PDU for a tracked cell. Returns -1 if the cell
+// has lost lock and has been marked for deletion.
+static int8 process_symbol(
+  tracked_cell_t & tracked_cell,
+  tracker_cell_state_t & state,
+  global_thread_data_t & global_thread_data,
+  td_fifo_pdu_t * pdu_p
+) {
+  // Get the next frequency domain sample.
+  cvec syms;
+  double frequency_offset;
+  double frame_timing;
+  get_fd(tracked_cell,global_thread_data.fc_requested,global_thread_data.fc_programmed,global_thread_data.fs_programmed,pdu_p,state.bulk_phase_offset,syms,frequency_offset,frame_timing);
+
+  // Save this information into the data fifo for further processing
+  // once channel estimates are ready. Channel estimates for this OFDM
+  // symbol may not be ready until several more OFDM symbols have been
+  // received.
+  data_fifo_pdu_t dfp;
+  dfp.slot_num=state.slot_num;
+  dfp.sym_num=state.sym_num;
+  dfp.syms=syms;
+  state.data_fifo.push_back(dfp);
+
+  // Extract any RS that might be present.
+  for (uint8 port_num=0;port_num<tracked_cell.n_ports;port_num++) {
+    double shift=state.rs_dl.get_shift(state.slot_num,state.sym_num,port_num);
+    if (isnan(shift))
+      continue;
+    cvec rs_raw=syms(itpp_ext::matlab_range(round_i(shift),6,71));
+    cvec ce_raw=elem_mult(rs_raw,conj(state.rs_dl.get_rs(state.slot_num,state.sym_num)));
+    ce_raw_fifo_pdu_t cerp;
+    cerp.shift=shift;
+    cerp.slot_num=state.slot_num;
+    cerp.sym_num=state.sym_num;
+    cerp.ce=ce_raw;
+    cerp.frequency_offset=frequency_offset;
+    cerp.frame_timing=frame_timing;
+    state.ce_raw_fifo[port_num].push_back(cerp);
+  }
 
-    // Tasks that need access to the filtered channel estimates should
-    // go in this loop.
-    for (uint8 port_num=0;port_num<tracked_cell.n_ports;port_num++) {
-      // For interpolation, we need two OFDM symbols.
-      if (ce_filt_fifo[port_num].size()!=2)
-        continue;
+  // For each port, filter and perform FOE, TOE, and interpolation on the raw
+  // channel estimates. Also perform some measurements.
+  // All tasks that need access to the raw channel estimates should
+  // go in this loop.
+  for (uint8 port_num=0;port_num<tracked_cell.n_ports;port_num++) {
+    // In order to filter the raw channel estimates for OFDM symbol n,
+    // we need the raw channel estimates for OFDM symbols n-1, n, and n+1.
+    if (state.ce_raw_fifo[port_num].size()!=3)
+      continue;
+
+    // Shortcuts
+    ce_raw_fifo_pdu_t & rs_prev=state.ce_raw_fifo[port_num][0];
+    ce_raw_fifo_pdu_t & rs_curr=state.ce_raw_fifo[port_num][1];
+    ce_raw_fifo_pdu_t & rs_next=state.ce_raw_fifo[port_num][2];
+
+    // Perform primitive filtering by averaging nearby samples.
+    const cvec rs_curr_filt=filter_ce(rs_prev,rs_curr,rs_next);
+    // Note correction for the estimation bias.
+    const double rs_curr_np=sigpower(rs_curr.ce-rs_curr_filt)*7/6;
+    // Note that this value can be negative!
+    const double rs_curr_tp=sigpower(rs_curr_filt);
+    const double rs_curr_sp_raw=rs_curr_tp-rs_curr_np/7;
+    const double rs_curr_sp=MAX(.00001,rs_curr_sp_raw);
+    // Store filtered channel estimates.
+    ce_filt_fifo_pdu_t pdu;
+    pdu.shift=rs_curr.shift;
+    pdu.slot_num=rs_curr.slot_num;
+    pdu.sym_num=rs_curr.sym_num;
+    pdu.tp=rs_curr_tp;
+    pdu.sp=rs_curr_sp;
+    pdu.sp_raw=rs_curr_sp_raw;
+    pdu.np=rs_curr_np;
+    pdu.ce_filt=rs_curr_filt;
+    state.ce_filt_fifo[port_num].push_back(pdu);
+
+    // FOE
+    do_foe(global_thread_data,rs_prev,rs_next,rs_curr_np,rs_curr_filt);
+
+    // TOE
+    //do_toe(tracked_cell,rs_curr,rs_curr_filt,rs_curr_np);
+    do_toe_v2(tracked_cell,rs_prev,rs_curr,rs_curr_sp,rs_curr_np);
+
+    // Estimate frequency domain autocorrelations.
+    do_ac_fd(tracked_cell,rs_curr,rs_curr_sp,rs_curr_np);
+
+    // Estimate the time domain autocorrelation function.
+    do_ac_td(tracked_cell,rs_curr,rs_curr_sp,state.ce_history[port_num]);
+
+    // Finished working with the raw channel estimates.
+    state.ce_raw_fifo[port_num].pop_front();
+  }
 
-      // Shortcuts
-      ce_filt_fifo_pdu_t & rs_prev=ce_filt_fifo[port_num][0];
-      ce_filt_fifo_pdu_t & rs_curr=ce_filt_fifo[port_num][1];
+  // Tasks that need access to the filtered channel estimates should
+  // go in this loop.
+  for (uint8 port_num=0;port_num<tracked_cell.n_ports;port_num++) {
+    // For interpolation, we need two OFDM symbols.
+    if (state.ce_filt_fifo[port_num].size()!=2)
+      continue;
 
-      interp2d(tracked_cell,rs_prev,rs_curr,port_num,ce_interp_fifo[port_num],ce_interp_fifo_initialized[port_num]);
+    // Shortcuts
+    ce_filt_fifo_pdu_t & rs_prev=state.ce_filt_fifo[port_num][0];
+    ce_filt_fifo_pdu_t & rs_curr=state.ce_filt_fifo[port_num][1];
 
-      // Finished working with the filtered channel estimates.
-      ce_filt_fifo[port_num].pop_front();
-    }
+    interp2d(tracked_cell,rs_prev,rs_curr,port_num,state.interp_scratch_prev,state.interp_scratch_curr,state.ce_interp_fifo[port_num],state.ce_interp_fifo_initialized[port_num]);
 
-    // Process data if channel estimates are available for each antenna and for
-    // every data sample.
-    while ((!data_fifo.empty())&&ce_ready(ce_interp_fifo)) {
+    // Finished working with the filtered channel estimates.
+    state.ce_filt_fifo[port_num].pop_front();
+  }
+
+  // Process data if channel estimates are available for each antenna and for
+  // every data sample.
+  while ((!state.data_fifo.empty())&&ce_ready(state.ce_interp_fifo)) {
 #ifndef NDEBUG
-      // Synchronization check.
-      for (uint8 t=0;t<tracked_cell.n_ports;t++) {
-        if (
-          (data_fifo.front().slot_num!=ce_interp_fifo[t].front().slot_num)||
-          (data_fifo.front().sym_num!=ce_interp_fifo[t].front().sym_num)
-        ) {
-          cerr << "Error: synchronization error! Check code!" << endl;
-          ABORT(-1);
-        }
+    // Synchronization check.
+    for (uint8 t=0;t<tracked_cell.n_ports;t++) {
+      if (
+        (state.data_fifo.front().slot_num!=state.ce_interp_fifo[t].fifo.front()->slot_num)||
+        (state.data_fifo.front().sym_num!=state.ce_interp_fifo[t].fifo.front()->sym_num)
+      ) {
+        cerr << "Error: synchronization error! Check code!" << endl;
+        ABORT(-1);
       }
+    }
 #endif
 
-      // For this OFDM symbol, extract the symbols, the channel estimates,
-      // signal power, etc.
-      cvec & syms=data_fifo.front().syms;
-      cmat ce(tracked_cell.n_ports,72);
-      vec tp(tracked_cell.n_ports);
-      vec sp(tracked_cell.n_ports);
-      vec sp_raw(tracked_cell.n_ports);
-      vec np(tracked_cell.n_ports);
-      uint8 data_slot_num=data_fifo.front().slot_num;
-      uint8 data_sym_num=data_fifo.front().sym_num;
-      for (uint8 t=0;t<tracked_cell.n_ports;t++) {
-        ce.set_row(t,ce_interp_fifo[t].front().ce_interp);
-        tp(t)=ce_interp_fifo[t].front().tp;
-        sp(t)=ce_interp_fifo[t].front().sp;
-        sp_raw(t)=ce_interp_fifo[t].front().sp_raw;
-        np(t)=ce_interp_fifo[t].front().np;
+    // For this OFDM symbol, extract the symbols, the channel estimates,
+    // signal power, etc.
+    cvec & syms=state.data_fifo.front().syms;
+    cmat ce(tracked_cell.n_ports,72);
+    vec tp(tracked_cell.n_ports);
+    vec sp(tracked_cell.n_ports);
+    vec sp_raw(tracked_cell.n_ports);
+    vec np(tracked_cell.n_ports);
+    uint8 data_slot_num=state.data_fifo.front().slot_num;
+    uint8 data_sym_num=state.data_fifo.front().sym_num;
+    for (uint8 t=0;t<tracked_cell.n_ports;t++) {
+      const ce_interp_fifo_pdu_t & pdu=*state.ce_interp_fifo[t].fifo.front();
+      ce.set_row(t,pdu.ce_interp);
+      tp(t)=pdu.tp;
+      sp(t)=pdu.sp;
+      sp_raw(t)=pdu.sp_raw;
+      np(t)=pdu.np;
+    }
+
+    // Store channel estimates
+    tracked_cell.meas.ce=ce;
+
+    // Store signal power measurements.
+    tracked_cell.meas.crs_sp_raw=sp_raw;
+    tracked_cell.meas.crs_np=np;
+    if (isnan(tracked_cell.meas.crs_sp_raw_av(0))) {
+      tracked_cell.meas.crs_tp_av=tp;
+      tracked_cell.meas.crs_sp_raw_av=sp_raw;
+      tracked_cell.meas.crs_np_av=np;
+    } else {
+      // This code only averages the measurements for PSS and SSS ofdm
+      // symbols.
+      if (((data_slot_num==0)||(data_slot_num==10))&&((data_sym_num==5)||(data_sym_num==6))) {
+        tracked_cell.meas.crs_tp_av=0.999*tracked_cell.meas.crs_tp_av+.001*tp;
+        tracked_cell.meas.crs_sp_raw_av=0.999*tracked_cell.meas.crs_sp_raw_av+.001*sp_raw;
+        tracked_cell.meas.crs_np_av=0.999*tracked_cell.meas.crs_np_av+.001*np;
       }
+    }
 
-      // Store channel estimates
-      {
-        boost::mutex::scoped_lock lock(tracked_cell.meas_mutex);
-        tracked_cell.ce=ce;
+    // Measure signal power and noise power on PSS/SSS (more accurate)
+    do_pss_sss_sigpower_ce(tracked_cell,syms,data_slot_num,data_sym_num,state.sss_sym);
+
+    // Perform MIB decoding
+    if (do_mib_decode(tracked_cell,syms,ce,sp,np,data_slot_num,data_sym_num,state.scr,state.mib_fifo,state.mib_fifo_synchronized)==-1) {
+      // We have failed to detect an MIB for a long time. The cell has
+      // been marked for deletion; stop servicing it.
+      return -1;
+    }
+
+    // Done processing data. Pop data vector and CE vectors. The CE
+    // PDUs go back to their pools for reuse.
+    state.data_fifo.pop_front();
+    for (uint8 t=0;t<tracked_cell.n_ports;t++) {
+      ce_interp_pdu_release(state.ce_interp_fifo[t],state.ce_interp_fifo[t].fifo.front());
+      state.ce_interp_fifo[t].fifo.pop_front();
+    }
+  }
+
+  // Increase the local counter.
+  slot_sym_inc(tracked_cell.n_symb_dl(),state.slot_num,state.sym_num);
+
+  return 0;
+}
+
+// Service one cell: initialize its state if this is the first service,
+// drain its fifo, and then either clear the scheduled flag or requeue the
+// cell if more data arrived while it was being drained.
+static void service_cell(
+  tracker_pool_t & tracker_pool,
+  tracked_cell_t & tracked_cell,
+  global_thread_data_t & global_thread_data
+) {
+  if (tracked_cell.tracker_state==NULL) {
+    // First service for this cell. The producer does not deliver data
+    // until tracker_thread_ready is set, so the fifo is still empty.
+    tracked_cell.tracker_state=new tracker_cell_state_t(tracked_cell);
+    tracked_cell.tracker_thread_ready=true;
+  }
+  tracker_cell_state_t & state=*tracked_cell.tracker_state;
+
+  // Used to measure the per-symbol processing time.
+  Real_Timer proc_timer;
+
+  if (!tracked_cell.kill_me) {
+    // If there is more than 1.5s worth of data in the fifo, dump
+    // data to allow the workers to catch up.
+    {
+      boost::mutex::scoped_lock lock(tracked_cell.fifo_mutex);
+      uint16 n_ofdm_1s=(tracked_cell.cp_type==cp_type_t::NORMAL)?(7*2*1000):(6*2*1000);
+      while (tracked_cell.fifo.size()>n_ofdm_1s*1.5) {
+        for (uint32 t=0;t<n_ofdm_1s;t++) {
+          // Return the dropped PDUs to the pool directly; the fifo
+          // mutex is already held.
+          tracked_cell.pdu_pool.push_back(tracked_cell.fifo.front());
+          tracked_cell.fifo.pop();
+        }
+        global_thread_data.cell_seconds_dropped_inc();
       }
+    }
 
-      // Store signal power measurements.
+    // Each iteration of this loop processes one OFDM symbol.
+    while (true) {
+      td_fifo_pdu_t * pdu_p;
       {
-        boost::mutex::scoped_lock lock(tracked_cell.meas_mutex);
-        tracked_cell.crs_sp_raw=sp_raw;
-        tracked_cell.crs_np=np;
-        if (isnan(tracked_cell.crs_sp_raw_av(0))) {
-          tracked_cell.crs_tp_av=tp;
-          tracked_cell.crs_sp_raw_av=sp_raw;
-          tracked_cell.crs_np_av=np;
-        } else {
-          if (0) {
-            tracked_cell.crs_tp_av=0.99999*tracked_cell.crs_tp_av+.00001*tp;
-            tracked_cell.crs_sp_raw_av=0.99999*tracked_cell.crs_sp_raw_av+.00001*sp_raw;
-            tracked_cell.crs_np_av=0.99999*tracked_cell.crs_np_av+.00001*np;
-          } else {
-            // This code only averages the measurements for PSS and SSS ofdm
-            // symbols.
-            if (((data_slot_num==0)||(data_slot_num==10))&&((data_sym_num==5)||(data_sym_num==6))) {
-              tracked_cell.crs_tp_av=0.999*tracked_cell.crs_tp_av+.001*tp;
-              tracked_cell.crs_sp_raw_av=0.999*tracked_cell.crs_sp_raw_av+.001*sp_raw;
-              tracked_cell.crs_np_av=0.999*tracked_cell.crs_np_av+.001*np;
-            }
-          }
+        boost::mutex::scoped_lock lock(tracked_cell.fifo_mutex);
+        if (tracked_cell.fifo.empty())
+          break;
+#ifndef NDEBUG
+        if ((tracked_cell.fifo.front()->slot_num!=state.slot_num)||(tracked_cell.fifo.front()->sym_num!=state.sym_num)) {
+          // We should never get here...
+          cerr << "Error: cell tracker synchronization error! Check code!" << endl;
+          ABORT(-1);
         }
+#endif
+        // Take ownership of the PDU; no copy is made.
+        pdu_p=tracked_cell.fifo.front();
+        tracked_cell.fifo.pop();
       }
 
-      // Measure signal power and noise power on PSS/SSS (more accurate)
-      do_pss_sss_sigpower_ce(tracked_cell,syms,data_slot_num,data_sym_num,sss_sym);
+      proc_timer.tic();
+      const int8 status=process_symbol(tracked_cell,state,global_thread_data,pdu_p);
+      global_thread_data.tracker_symbol_hist.record(proc_timer.toc());
+      global_thread_data.tracker_symbols_processed.fetch_add(1,std::memory_order_relaxed);
+      if (status==-1)
+        break;
+    }
 
-      // Perform MIB decoding
-      if (do_mib_decode(tracked_cell,syms,ce,sp,np,data_slot_num,data_sym_num,scr,mib_fifo,mib_fifo_synchronized)==-1) {
-        // We have failed to detect an MIB for a long time. Exit this
-        // thread.
-        //cout << "Tracker thread exiting..." << endl;
-        return;
-      }
+    // Publish the measurements gathered during this service job so that
+    // the display thread can take a consistent snapshot. Publishing once
+    // per job (rather than once per symbol) keeps the copy overhead
+    // negligible while still updating far faster than the display
+    // refreshes.
+    tracked_cell.publish_meas();
+  }
 
-      // Done processing data. Pop data vector and CE vectors.
-      data_fifo.pop_front();
-      for (uint8 t=0;t<tracked_cell.n_ports;t++) {
-        ce_interp_fifo[t].pop_front();
-      }
+  // Give the cell back to the pool. If the producer delivered more data
+  // while this job was draining the fifo, requeue the cell so that it is
+  // picked up again (possibly by another worker); the producer will not
+  // have scheduled it itself because the scheduled flag was still set.
+  {
+    boost::mutex::scoped_lock lock(tracker_pool.mutex);
+    bool more;
+    {
+      boost::mutex::scoped_lock lock2(tracked_cell.fifo_mutex);
+      more=!tracked_cell.fifo.empty();
     }
+    if (more&&!tracked_cell.kill_me) {
+      tracker_pool.pending.push(&tracked_cell);
+      tracker_pool.condition.notify_one();
+    } else {
+      tracked_cell.scheduled=false;
+    }
+  }
+}
 
-    // Increase the local counter.
-    slot_sym_inc(tracked_cell.n_symb_dl(),slot_num,sym_num);
+// Worker thread of the tracker pool. A fixed number of these service all
+// tracked cells, replacing the old thread-per-cell design.
+void tracker_worker_thread(
+  tracker_pool_t & tracker_pool,
+  global_thread_data_t & global_thread_data
+) {
+  while (true) {
+    tracked_cell_t * cell_p;
+    {
+      boost::mutex::scoped_lock lock(tracker_pool.mutex);
+      while (tracker_pool.pending.empty()) {
+        tracker_pool.condition.wait(lock);
+      }
+      cell_p=tracker_pool.pending.front();
+      tracker_pool.pending.pop();
+    }
+    service_cell(tracker_pool,*cell_p,global_thread_data);
   }
 }
 